@@ -0,0 +1,90 @@
+#include "alloc_tracker.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static thread_local uint64_t thread_count = 0;
+static thread_local uint64_t thread_bytes = 0;
+static std::atomic<uint64_t> all_count(0);
+
+uint64_t
+alloc_tracker::count()
+{
+    return thread_count;
+}
+
+uint64_t
+alloc_tracker::bytes()
+{
+    return thread_bytes;
+}
+
+uint64_t
+alloc_tracker::total()
+{
+    return all_count.load(std::memory_order_relaxed);
+}
+
+static void*
+allocate(size_t size, size_t align)
+{
+    thread_count++;
+    thread_bytes += size;
+    all_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (size == 0) size = 1;
+    if (align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) return malloc(size);
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, align, size) == 0 ? p : nullptr;
+#endif
+}
+
+static void
+release(void* p, [[maybe_unused]] size_t align)
+{
+#ifdef _WIN32
+    if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        _aligned_free(p);
+        return;
+    }
+#endif
+    free(p);
+}
+
+static void*
+allocate_or_throw(size_t size, size_t align)
+{
+    void* p = allocate(size, align);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return allocate_or_throw(size, 0); }
+void* operator new[](size_t size) { return allocate_or_throw(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t align) { return allocate_or_throw(size, (size_t)align); }
+void* operator new[](size_t size, std::align_val_t align) { return allocate_or_throw(size, (size_t)align); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return allocate(size, (size_t)align); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return allocate(size, (size_t)align); }
+
+void operator delete(void* p) noexcept { release(p, 0); }
+void operator delete[](void* p) noexcept { release(p, 0); }
+void operator delete(void* p, size_t) noexcept { release(p, 0); }
+void operator delete[](void* p, size_t) noexcept { release(p, 0); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p, 0); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p, 0); }
+void operator delete(void* p, std::align_val_t align) noexcept { release(p, (size_t)align); }
+void operator delete[](void* p, std::align_val_t align) noexcept { release(p, (size_t)align); }
+void operator delete(void* p, size_t, std::align_val_t align) noexcept { release(p, (size_t)align); }
+void operator delete[](void* p, size_t, std::align_val_t align) noexcept { release(p, (size_t)align); }
+void operator delete(void* p, std::align_val_t align, const std::nothrow_t&) noexcept { release(p, (size_t)align); }
+void operator delete[](void* p, std::align_val_t align, const std::nothrow_t&) noexcept { release(p, (size_t)align); }
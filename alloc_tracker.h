@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// Heap allocation counts per thread, from the replaced global operator new in
+// alloc_tracker.cpp. The counters are thread_local so counting costs one increment and
+// no lock; a loop reads count() before and after an iteration to see whether its steady
+// state touches the heap. Only the executable links the replacement in, the C library
+// leaves its host's allocator alone. malloc() and the CRT's own buffers are not seen.
+class alloc_tracker
+{
+public:
+    // operator new calls and bytes asked for by the calling thread so far
+    static uint64_t count();
+    static uint64_t bytes();
+    // every thread together
+    static uint64_t total();
+};
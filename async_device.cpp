@@ -0,0 +1,150 @@
+#include "async_device.h"
+#include "protocol3.h"
+
+#include <algorithm>
+#include <string.h>
+
+static void
+invalid_rsp(protocol::parsed_rsp* result)
+{
+    result->msgId = protocol::INVALID_MSG_ID;
+    result->status = 0;
+    result->payload_size = 0;
+    result->valid = false;
+}
+
+async_device::send_awaitable::send_awaitable(async_device* device, uint16_t msgId, const uint8_t* p_buf, int p_size) :
+    device(device), msgId(msgId)
+{
+    frame[0] = 0x00; // hid report id
+    if (device->proto == PROTOCOL_IMU)
+        frame_len = protocol3::cmd_build((uint8_t)msgId, p_buf, p_size, &frame[1], sizeof(frame) - 1);
+    else
+        frame_len = protocol::cmd_build(msgId, p_buf, p_size, &frame[1], sizeof(frame) - 1);
+    invalid_rsp(&result);
+}
+
+bool
+async_device::send_awaitable::await_suspend(std::coroutine_handle<> h)
+{
+    if (frame_len == 0 || device->t->write(frame, frame_len + 1) < 0) {
+        return false; // resume straight away with an invalid result
+    }
+
+    waiter w = { msgId, h, &result, std::chrono::steady_clock::now() + device->timeout };
+    device->pending.push_back(w);
+    return true;
+}
+
+async_device::async_device(event_loop& loop, transport* t, protocol_t p, int timeout_ms) :
+    loop(loop), t(t), proto(p), timeout(timeout_ms), unsolicited(nullptr), unsolicited_ctx(nullptr)
+{
+    loop.devices.push_back(this);
+}
+
+async_device::~async_device()
+{
+    loop.devices.erase(std::remove(loop.devices.begin(), loop.devices.end(), this), loop.devices.end());
+}
+
+async_device::send_awaitable
+async_device::send(uint16_t msgId, const uint8_t* p_buf, int p_size)
+{
+    return send_awaitable(this, msgId, p_buf, p_size);
+}
+
+async_device::send_awaitable
+async_device::send(const std::string& msg_id, const uint8_t* p_buf, int p_size)
+{
+    uint16_t msgId = proto == PROTOCOL_IMU ? protocol3::hexForKey(msg_id) : protocol::hexForKey(msg_id);
+    return send_awaitable(this, msgId, p_buf, p_size);
+}
+
+bool
+async_device::poll(int timeout_ms, std::vector<std::coroutine_handle<>>* ready)
+{
+    uint8_t read_buf[1024];
+    int res = t->read(read_buf, sizeof(read_buf), timeout_ms);
+    if (res <= 0) return false;
+
+    protocol::parsed_rsp rsp;
+    if (proto == PROTOCOL_IMU) {
+        protocol3::parsed_rsp rsp3;
+        if (read_buf[0] == 0xaa) {
+            protocol3::parse_rsp(read_buf, res, &rsp3);
+        }
+        else {
+            rsp3.msgId = protocol3::INVALID_MSG_ID; // IMU stream report, not a reply
+        }
+        rsp.msgId = rsp3.msgId == protocol3::INVALID_MSG_ID ? protocol::INVALID_MSG_ID : rsp3.msgId;
+        rsp.status = 0;
+        rsp.payload_size = rsp3.msgId == protocol3::INVALID_MSG_ID ? 0 : rsp3.payload_size;
+        rsp.valid = rsp3.msgId != protocol3::INVALID_MSG_ID && rsp3.valid;
+        memcpy(rsp.payload, rsp3.payload, rsp.payload_size);
+    }
+    else {
+        protocol::parse_rsp(read_buf, res, &rsp);
+    }
+
+    // oldest waiter for this id gets the reply
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i].msgId == rsp.msgId) {
+            *pending[i].result = rsp;
+            ready->push_back(pending[i].h);
+            pending.erase(pending.begin() + i);
+            return true;
+        }
+    }
+
+    if (unsolicited != nullptr) unsolicited(read_buf, res, unsolicited_ctx);
+    return true;
+}
+
+void
+async_device::expire(std::chrono::steady_clock::time_point now, std::vector<std::coroutine_handle<>>* ready)
+{
+    for (size_t i = 0; i < pending.size();) {
+        if (pending[i].deadline <= now) {
+            ready->push_back(pending[i].h); // result is still the invalid placeholder
+            pending.erase(pending.begin() + i);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+bool
+event_loop::step(int idle_timeout_ms)
+{
+    ready.clear();
+    bool progress = false;
+
+    for (async_device* d : devices) {
+        while (d->poll(0, &ready)) progress = true;
+    }
+
+    // nothing waiting anywhere: block on one device at a time instead of spinning
+    if (!progress && !devices.empty()) {
+        idle_device = (idle_device + 1) % devices.size();
+        progress = devices[idle_device]->poll(idle_timeout_ms, &ready);
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (async_device* d : devices) d->expire(now, &ready);
+
+    // resume after polling, a resumed coroutine may queue new sends
+    for (std::coroutine_handle<> h : ready) h.resume();
+
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [](const std::unique_ptr<task<void>>& t) { return t->done(); }), tasks.end());
+
+    return progress || !ready.empty();
+}
+
+void
+event_loop::run()
+{
+    while (!tasks.empty()) {
+        step(1);
+    }
+}
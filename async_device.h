@@ -0,0 +1,181 @@
+#pragma once
+#include "protocol.h"
+#include "transport.h"
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+class event_loop;
+
+// Coroutine returned by device command sequences. It starts running immediately,
+// and co_await on an unfinished task suspends the caller until that task returns.
+template <typename T = void>
+class task;
+
+class task_promise_base
+{
+public:
+    std::coroutine_handle<> continuation;
+    bool finished = false;
+
+    std::suspend_never initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            task_promise_base& p = h.promise();
+            p.finished = true;
+            return p.continuation ? p.continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+class task_promise : public task_promise_base
+{
+public:
+    T value;
+    task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+};
+
+template <>
+class task_promise<void> : public task_promise_base
+{
+public:
+    task<void> get_return_object();
+    void return_void() {}
+};
+
+template <typename T>
+class task
+{
+public:
+    typedef task_promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    explicit task(handle_type h) : h(h) {}
+    task(task&& other) noexcept : h(std::exchange(other.h, nullptr)) {}
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    ~task() { if (h) h.destroy(); }
+
+    bool done() const { return !h || h.promise().finished; }
+
+    bool await_ready() const noexcept { return done(); }
+    void await_suspend(std::coroutine_handle<> caller) noexcept { h.promise().continuation = caller; }
+    T await_resume()
+    {
+        if constexpr (!std::is_void<T>::value) return std::move(h.promise().value);
+    }
+
+private:
+    handle_type h;
+};
+
+template <typename T>
+task<T>
+task_promise<T>::get_return_object()
+{
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void>
+task_promise<void>::get_return_object()
+{
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+// One interface of the glasses driven by an event_loop. co_await send(...) writes the
+// command and resumes the caller with the matching reply (valid == false on timeout),
+// so any number of sequences can be in flight on one thread.
+class async_device
+{
+public:
+    enum protocol_t {
+        PROTOCOL_CONTROL,    // protocol, interface 4
+        PROTOCOL_IMU         // protocol3, interface 3
+    };
+
+    class send_awaitable
+    {
+    public:
+        send_awaitable(async_device* device, uint16_t msgId, const uint8_t* p_buf, int p_size);
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        protocol::parsed_rsp await_resume() { return result; }
+
+    private:
+        async_device* device;
+        uint16_t msgId;
+        uint8_t frame[1024];
+        int frame_len;
+        protocol::parsed_rsp result;
+    };
+
+    // unsolicited reports (pushes, IMU samples) that no send() is waiting for
+    typedef void (*unsolicited_fn)(const uint8_t* buffer, int size, void* ctx);
+
+    async_device(event_loop& loop, transport* t, protocol_t p, int timeout_ms = 1000);
+    ~async_device();
+
+    send_awaitable send(uint16_t msgId, const uint8_t* p_buf = nullptr, int p_size = 0);
+    send_awaitable send(const std::string& msg_id, const uint8_t* p_buf = nullptr, int p_size = 0);
+
+    void set_unsolicited(unsolicited_fn fn, void* ctx) { unsolicited = fn; unsolicited_ctx = ctx; }
+    size_t outstanding() const { return pending.size(); }
+
+private:
+    friend class event_loop;
+
+    typedef struct {
+        uint16_t msgId;
+        std::coroutine_handle<> h;
+        protocol::parsed_rsp* result;
+        std::chrono::steady_clock::time_point deadline;
+    } waiter;
+
+    // reads whatever is available, returns false if nothing was read
+    bool poll(int timeout_ms, std::vector<std::coroutine_handle<>>* ready);
+    void expire(std::chrono::steady_clock::time_point now, std::vector<std::coroutine_handle<>>* ready);
+
+    event_loop& loop;
+    transport* t;
+    protocol_t proto;
+    std::chrono::milliseconds timeout;
+    std::vector<waiter> pending;
+    unsolicited_fn unsolicited;
+    void* unsolicited_ctx;
+};
+
+// Single threaded scheduler: polls every registered device and resumes the
+// coroutines whose replies arrived or timed out.
+class event_loop
+{
+public:
+    void spawn(task<void>&& t) { tasks.push_back(std::make_unique<task<void>>(std::move(t))); }
+    // runs until every spawned task has finished
+    void run();
+    bool step(int idle_timeout_ms);
+
+private:
+    friend class async_device;
+
+    std::vector<async_device*> devices;
+    std::vector<std::unique_ptr<task<void>>> tasks;
+    std::vector<std::coroutine_handle<>> ready; // cleared every step, keeps its capacity
+    size_t idle_device = 0;
+};
@@ -0,0 +1,112 @@
+#include "capture_transport.h"
+
+#include <string.h>
+
+const char capture_transport::MAGIC[8] = { 'R', 'U', 'C', 'A', 'P', '0', '0', '1' };
+const int INDEX_ENTRY_SIZE = /*NS*/8 + /*OFFSET*/8;
+const int INDEX_EVERY_READS = 64;
+const uint64_t INDEX_EVERY_NS = 1000000000ull;
+const size_t WRITE_BUFFER = 1 << 20;
+
+static void
+put_le(uint8_t* buf, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+capture_transport::capture_transport(transport* inner, std::chrono::steady_clock::time_point origin) :
+    inner(inner), origin(origin), file(nullptr), index(nullptr), offset(0), record_count(0), reads_since_index(0), last_index_ns(0)
+{
+}
+
+capture_transport::~capture_transport()
+{
+    close();
+}
+
+bool
+capture_transport::open(const std::string& path, int interface_num)
+{
+    close();
+
+    file = fopen(path.c_str(), "wb");
+    index = fopen((path + ".idx").c_str(), "wb");
+    if (file == nullptr || index == nullptr) {
+        close();
+        return false;
+    }
+    // the capture sits on the read path, let stdio batch the disk writes
+    setvbuf(file, nullptr, _IOFBF, WRITE_BUFFER);
+
+    uint8_t header[HEADER_SIZE] = { 0 };
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    put_le(&header[8], (uint32_t)interface_num, 4);
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        close();
+        return false;
+    }
+
+    offset = HEADER_SIZE;
+    record_count = 0;
+    reads_since_index = INDEX_EVERY_READS; // index the first read
+    return true;
+}
+
+void
+capture_transport::close()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (file != nullptr) fclose(file);
+    if (index != nullptr) fclose(index);
+    file = nullptr;
+    index = nullptr;
+}
+
+void
+capture_transport::append(direction_t dir, const uint8_t* data, size_t length)
+{
+    if (length > MAX_RECORD) length = MAX_RECORD;
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (file == nullptr) return;
+
+    // index entries only point at reads, those are what replay seeks to
+    if (dir == DIR_READ && (reads_since_index >= INDEX_EVERY_READS || ns - last_index_ns >= INDEX_EVERY_NS)) {
+        uint8_t entry[INDEX_ENTRY_SIZE];
+        put_le(&entry[0], ns, 8);
+        put_le(&entry[8], offset, 8);
+        fwrite(entry, 1, sizeof(entry), index);
+        reads_since_index = 0;
+        last_index_ns = ns;
+    }
+
+    uint8_t header[RECORD_HEADER_SIZE];
+    put_le(&header[0], ns, 8);
+    header[8] = (uint8_t)dir;
+    header[9] = 0;
+    put_le(&header[10], length, 2);
+
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(data, 1, length, file);
+    offset += RECORD_HEADER_SIZE + length;
+    record_count++;
+    if (dir == DIR_READ) reads_since_index++;
+}
+
+int
+capture_transport::write(const uint8_t* data, size_t length)
+{
+    int res = inner->write(data, length);
+    if (res >= 0) append(DIR_WRITE, data, length);
+    return res;
+}
+
+int
+capture_transport::read(uint8_t* data, size_t length, int timeout_ms)
+{
+    int res = inner->read(data, length, timeout_ms);
+    if (res > 0) append(DIR_READ, data, res);
+    return res;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "transport.h"
+
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Records everything that passes through another transport, one file per interface:
+//
+//   header  "RUCAP001", u32 interface number, u32 reserved
+//   record  u64 ns since the capture origin, u8 direction, u8 reserved, u16 length, data
+//
+// Reports are stored exactly as hidapi returned them, writes include the report id byte.
+// Every 64 reads or 1 s of traffic an (ns, file offset) pair is appended to <path>.idx,
+// which lets replay_transport seek an hour-long capture without scanning it.
+class capture_transport : public transport
+{
+public:
+    static const char MAGIC[8];
+    static const int HEADER_SIZE = 16;
+    static const int RECORD_HEADER_SIZE = 12;
+    static const int MAX_RECORD = 1024;
+
+    enum direction_t {
+        DIR_READ = 0,
+        DIR_WRITE = 1
+    };
+
+    // origin is shared by the captures of one session so their timestamps line up
+    capture_transport(transport* inner, std::chrono::steady_clock::time_point origin);
+    ~capture_transport();
+
+    bool open(const std::string& path, int interface_num);
+    void close();
+
+    int write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t length, int timeout_ms) override;
+
+    uint64_t records() const { return record_count; }
+
+private:
+    void append(direction_t dir, const uint8_t* data, size_t length);
+
+    transport* inner;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex lock;                 // reads and writes may come from different threads
+    FILE* file;
+    FILE* index;
+    uint64_t offset;
+    uint64_t record_count;
+    int reads_since_index;
+    uint64_t last_index_ns;
+};
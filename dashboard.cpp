@@ -0,0 +1,185 @@
+#include "dashboard.h"
+#include "protocol.h"
+#include "protocol3.h"
+#include "imu.h"
+#include "display_mode.h"
+#include "protocol_codec.h"
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+const uint32_t KEY_USED = 1u << 24;
+const uint16_t IMU_SAMPLE_ID = 0xffff;   // stream reports have no msgId of their own
+// two missed beats and some slack before the link counts as stale
+const uint64_t HEARTBEAT_STALE_NS = protocol::HEARTBEAT_PERIOD_NS * 5 / 2;
+const uint8_t CONTROL_HEAD = 0xfd;
+const uint8_t IMU_HEAD = 0xaa;
+
+dashboard::dashboard() :
+    untracked(0), imu_samples(0), imu_dropped(0), last_imu_timestamp(0), corrupt_control(0), corrupt_imu(0), errors_control(0), errors_imu(0),
+    heartbeats(0), last_heartbeat(0), mode(display_mode::MODE_UNKNOWN), probe_id(protocol::INVALID_MSG_ID), probe_at(0),
+    rendered_samples(0), rendered_heartbeats(0)
+{
+    for (slot& s : slots) {
+        s.key = 0;
+        s.count = 0;
+        s.rendered = 0;
+    }
+
+    started = now_ns();
+    rendered_at = started;
+}
+
+uint64_t
+dashboard::now_ns()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// open addressing with a CAS on the key, entries are never removed
+void
+dashboard::count(int interface_num, uint16_t msgId)
+{
+    uint32_t key = KEY_USED | (uint32_t)interface_num << 16 | msgId;
+    uint32_t i = (key * 2654435761u) >> 24;
+
+    for (int probe = 0; probe < SLOTS; probe++, i = (i + 1) % SLOTS) {
+        uint32_t current = slots[i].key.load(std::memory_order_acquire);
+        if (current == 0) {
+            if (slots[i].key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) current = key;
+        }
+        if (current == key) {
+            slots[i].count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    untracked.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+dashboard::on_control(const uint8_t* buffer, int size, uint64_t now)
+{
+    // parse_rsp prints a bad head, which would scroll the dashboard away
+    protocol::parsed_rsp rsp;
+    rsp.valid = false;
+    if (size > 0 && buffer[0] == CONTROL_HEAD) protocol::parse_rsp(buffer, size, &rsp);
+    if (!rsp.valid) {
+        corrupt_control.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    count(4, rsp.msgId);
+
+    protocol_codec::disp_mode_reply reply;
+    if (rsp.msgId == protocol::P_UKNOWN_HEARTBEAT || rsp.msgId == protocol::P_UKNOWN_HEARTBEAT_2) {
+        heartbeats.fetch_add(1, std::memory_order_relaxed);
+        last_heartbeat.store(now, std::memory_order_relaxed);
+    }
+    else if (rsp.msgId == protocol::R_DISP_MODE && protocol_codec::decode(rsp.payload, rsp.payload_size, &reply)) {
+        mode.store(reply.mode, std::memory_order_relaxed);
+    }
+
+    if (rsp.msgId == probe_id.load(std::memory_order_relaxed)) {
+        uint64_t sent = probe_at.exchange(0, std::memory_order_relaxed);
+        if (sent != 0 && now > sent) round_trip.record(now - sent);
+    }
+}
+
+void
+dashboard::on_imu(const uint8_t* buffer, int size)
+{
+    imu::sample sample;
+    if (imu::parse_sample(buffer, size, &sample)) {
+        count(3, IMU_SAMPLE_ID);
+        imu_samples.fetch_add(1, std::memory_order_relaxed);
+
+        // anything past 1.5 periods is counted as the samples that should have been there
+        const uint64_t period = 1000000000ull / imu::NOMINAL_RATE_HZ;
+        if (last_imu_timestamp != 0 && sample.timestamp > last_imu_timestamp + period + period / 2) {
+            imu_dropped.fetch_add((sample.timestamp - last_imu_timestamp + period / 2) / period - 1, std::memory_order_relaxed);
+        }
+        last_imu_timestamp = sample.timestamp;
+        return;
+    }
+
+    // anything else is a sample report parse_sample turned down, don't let parse_rsp print it
+    protocol3::parsed_rsp rsp;
+    rsp.valid = false;
+    if (size > 0 && buffer[0] == IMU_HEAD) protocol3::parse_rsp(buffer, size, &rsp);
+    if (!rsp.valid) {
+        corrupt_imu.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    count(3, rsp.msgId);
+}
+
+void
+dashboard::on_read_error(int interface_num)
+{
+    (interface_num == 3 ? errors_imu : errors_control).fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+dashboard::probe_sent(uint16_t msgId, uint64_t now)
+{
+    probe_id.store(msgId, std::memory_order_relaxed);
+    probe_at.store(now, std::memory_order_relaxed);
+}
+
+void
+dashboard::render(std::ostream& out, uint64_t now)
+{
+    double elapsed = (now - rendered_at) / 1e9;
+    if (elapsed <= 0) elapsed = 1;
+    uint64_t uptime_s = (now - started) / 1000000000ull;
+
+    // built off screen and written in one go so the terminal doesn't flicker
+    std::ostringstream frame;
+    frame << "\x1b[H\x1b[2J";
+    frame << "Real_Utilities dashboard   up " << std::setfill('0') << std::setw(2) << uptime_s / 3600 << ":" << std::setw(2) << uptime_s / 60 % 60 << ":" << std::setw(2) << uptime_s % 60
+        << "   (ctrl-c to quit)" << std::setfill(' ') << "\n\n";
+
+    frame << std::left << std::setw(10) << "interface" << std::setw(34) << "message" << std::setw(8) << "id" << std::right << std::setw(12) << "rate/s" << std::setw(14) << "total" << "\n";
+    for (int iface = 3; iface <= 4; iface++) {
+        for (slot& s : slots) {
+            uint32_t key = s.key.load(std::memory_order_acquire);
+            if (key == 0 || (int)(key >> 16 & 0xff) != iface) continue;
+
+            uint16_t msgId = key & 0xffff;
+            uint64_t total = s.count.load(std::memory_order_relaxed);
+            const char* name = iface == 4 ? protocol::keyForHex(msgId) : msgId == IMU_SAMPLE_ID ? "IMU_SAMPLE" : protocol3::keyForHex((uint8_t)msgId);
+
+            std::ostringstream id;
+            if (msgId != IMU_SAMPLE_ID) id << std::hex << msgId;
+            frame << std::left << std::setw(10) << (iface == 4 ? "control" : "imu") << std::setw(34) << name << std::setw(8) << id.str()
+                << std::right << std::setw(12) << std::fixed << std::setprecision(1) << (total - s.rendered) / elapsed << std::setw(14) << total << "\n";
+            s.rendered = total;
+        }
+    }
+    if (untracked.load(std::memory_order_relaxed) > 0) frame << "untracked: " << untracked.load(std::memory_order_relaxed) << "\n";
+
+    uint64_t samples = imu_samples.load(std::memory_order_relaxed);
+    frame << "\n" << std::left << std::setw(24) << "imu samples" << std::fixed << std::setprecision(1)
+        << (samples - rendered_samples) / elapsed << "/s, " << imu_dropped.load(std::memory_order_relaxed) << " dropped\n";
+    frame << std::setw(24) << "corrupt frames" << "control " << corrupt_control.load(std::memory_order_relaxed) << ", imu " << corrupt_imu.load(std::memory_order_relaxed) << "\n";
+    frame << std::setw(24) << "read errors" << "control " << errors_control.load(std::memory_order_relaxed) << ", imu " << errors_imu.load(std::memory_order_relaxed) << "\n";
+
+    frame << std::setw(24) << "round trip (ms)";
+    if (round_trip.count() == 0) frame << "no replies yet\n";
+    else frame << std::setprecision(2) << "p50 " << round_trip.percentile(50) / 1e6 << "  p99 " << round_trip.percentile(99) / 1e6 << "  p99.9 " << round_trip.percentile(99.9) / 1e6
+        << "  max " << round_trip.max() / 1e6 << "  (" << round_trip.count() << ")\n";
+
+    uint64_t beats = heartbeats.load(std::memory_order_relaxed);
+    uint64_t last = last_heartbeat.load(std::memory_order_relaxed);
+    frame << std::setw(24) << "heartbeat";
+    if (last == 0) frame << "none yet\n";
+    else frame << std::setprecision(1) << (now - last) / 1e9 << " s ago, " << (beats - rendered_heartbeats) / elapsed << "/s  " << (now - last > HEARTBEAT_STALE_NS ? "STALE" : "ok") << "\n";
+
+    frame << std::setw(24) << "display mode" << display_mode::mode_name((display_mode::mode_t)mode.load(std::memory_order_relaxed)) << "\n";
+
+    out << frame.str() << std::flush;
+
+    rendered_at = now;
+    rendered_samples = samples;
+    rendered_heartbeats = beats;
+}
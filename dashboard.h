@@ -0,0 +1,63 @@
+#pragma once
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+
+// Live view of both interfaces. The reader threads only bump relaxed atomic counters;
+// render() runs on its own thread at a low fixed rate and turns the deltas since the
+// previous frame into rates, so watching the link costs the readers next to nothing.
+class dashboard
+{
+public:
+    static const int SLOTS = 256;        // distinct (interface, msgId) pairs tracked
+
+    dashboard();
+
+    static uint64_t now_ns();
+
+    // reader threads, one per interface
+    void on_control(const uint8_t* buffer, int size, uint64_t now);
+    void on_imu(const uint8_t* buffer, int size);
+    void on_read_error(int interface_num);
+
+    // stamps a round trip probe, the next reply with the same msgId records the latency
+    void probe_sent(uint16_t msgId, uint64_t now);
+
+    // one frame: clears the terminal and redraws, call from a single thread
+    void render(std::ostream& out, uint64_t now);
+
+private:
+    struct slot {
+        std::atomic<uint32_t> key;       // 0 = empty, else 1 << 24 | interface << 16 | msgId
+        std::atomic<uint64_t> count;
+        uint64_t rendered;               // count at the previous frame, render() only
+    };
+
+    void count(int interface_num, uint16_t msgId);
+
+    slot slots[SLOTS];
+    std::atomic<uint64_t> untracked;     // table full
+
+    std::atomic<uint64_t> imu_samples;
+    std::atomic<uint64_t> imu_dropped;   // estimated from gaps in the device timestamps
+    uint64_t last_imu_timestamp;         // imu reader only
+    std::atomic<uint64_t> corrupt_control;
+    std::atomic<uint64_t> corrupt_imu;
+    std::atomic<uint64_t> errors_control;
+    std::atomic<uint64_t> errors_imu;
+
+    std::atomic<uint64_t> heartbeats;
+    std::atomic<uint64_t> last_heartbeat;
+    std::atomic<int> mode;
+
+    std::atomic<uint16_t> probe_id;
+    std::atomic<uint64_t> probe_at;
+    latency_histogram round_trip;
+
+    uint64_t started;
+    uint64_t rendered_at;
+    uint64_t rendered_samples;
+    uint64_t rendered_heartbeats;
+};
@@ -0,0 +1,434 @@
+#include "device_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+const int RECORD_HEADER_SIZE = /*HOST_MS*/8 + /*DEV_TS*/4 + /*LEVEL*/1 + /*MODULE_LEN*/1 + /*MSG_LEN*/2;
+const int INDEX_ENTRY_SIZE = /*HOST_MS*/8 + /*OFFSET*/8;
+const uint32_t INDEX_EVERY_RECORDS = 64;
+const uint64_t INDEX_EVERY_MS = 1000;
+const size_t MAX_LINE = 1024; // device lines are short, cap runaway data without a newline
+
+static void
+put_le(uint8_t* buf, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+get_le(const uint8_t* buf, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | buf[i];
+    return value;
+}
+
+// long is 32-bit on Windows, the store is expected to grow past 2 GB
+static int
+seek64(FILE* f, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, origin);
+#else
+    return fseeko(f, (off_t)offset, origin);
+#endif
+}
+
+static uint64_t
+tell64(FILE* f)
+{
+#ifdef _WIN32
+    return (uint64_t)_ftelli64(f);
+#else
+    return (uint64_t)ftello(f);
+#endif
+}
+
+static uint64_t
+file_size(FILE* f)
+{
+    seek64(f, 0, SEEK_END);
+    return tell64(f);
+}
+
+static bool
+truncate_file(FILE* f, uint64_t size)
+{
+#ifdef _WIN32
+    return _chsize_s(_fileno(f), (__int64)size) == 0;
+#else
+    return ftruncate(fileno(f), (off_t)size) == 0;
+#endif
+}
+
+static bool
+read_index(FILE* index, uint64_t i, uint64_t* host_ms, uint64_t* offset)
+{
+    uint8_t idx[INDEX_ENTRY_SIZE];
+    if (seek64(index, i * INDEX_ENTRY_SIZE, SEEK_SET) != 0 || fread(idx, 1, sizeof(idx), index) != sizeof(idx)) return false;
+    *host_ms = get_le(&idx[0], 8);
+    *offset = get_le(&idx[8], 8);
+    return true;
+}
+
+// last index entry, among the first n, that points below limit; n is lowered to drop the ones after it
+static bool
+last_index_below(FILE* index, uint64_t limit, uint64_t* n, uint64_t* offset)
+{
+    uint64_t host_ms;
+    while (*n > 0) {
+        if (!read_index(index, *n - 1, &host_ms, offset)) return false;
+        if (*offset < limit) return true;
+        (*n)--;
+    }
+    return false;
+}
+
+// A crash can leave half a record at the end of the data and index entries for records
+// that never reached it. Cut the data back to the end of its last whole record, found by
+// walking the headers from the last index entry that is still inside the data, and drop
+// the index entries (and any half entry) beyond it, so the next session appends cleanly.
+// newest_ms is the latest host time among the records walked, 0 for an empty store.
+static bool
+repair_tail(const std::string& base_path, uint64_t* newest_ms)
+{
+    *newest_ms = 0;
+    FILE* data = fopen((base_path + ".dlog").c_str(), "r+b");
+    if (data == nullptr) return true; // nothing written yet
+
+    uint64_t data_size = file_size(data);
+    FILE* index = fopen((base_path + ".didx").c_str(), "r+b");
+    uint64_t index_size = index != nullptr ? file_size(index) : 0;
+    uint64_t entries = index_size / INDEX_ENTRY_SIZE;
+
+    uint64_t scan_from = 0;
+    if (index != nullptr && !last_index_below(index, data_size, &entries, &scan_from)) scan_from = 0;
+
+    uint64_t good_end = scan_from;
+    uint8_t hdr[RECORD_HEADER_SIZE];
+    seek64(data, good_end, SEEK_SET);
+    while (fread(hdr, 1, sizeof(hdr), data) == sizeof(hdr)) {
+        uint64_t end = good_end + sizeof(hdr) + hdr[13] + get_le(&hdr[14], 2);
+        if (end > data_size) break;
+        *newest_ms = std::max(*newest_ms, get_le(&hdr[0], 8));
+        good_end = end;
+        seek64(data, good_end, SEEK_SET);
+    }
+
+    bool ok = good_end == data_size || truncate_file(data, good_end);
+    fclose(data);
+
+    if (index != nullptr) {
+        uint64_t offset = 0;
+        last_index_below(index, good_end, &entries, &offset);
+        if (entries * INDEX_ENTRY_SIZE != index_size) ok = truncate_file(index, entries * INDEX_ENTRY_SIZE) && ok;
+        fclose(index);
+    }
+    return ok;
+}
+
+static std::string
+upper(const std::string& s)
+{
+    std::string out(s);
+    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) { return (char)toupper(c); });
+    return out;
+}
+
+static bool
+is_timestamp(const char* s, size_t len)
+{
+    if (len == 0) return false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (!isdigit(c) && c != '.' && c != ':') return false;
+    }
+    return true;
+}
+
+// case insensitive compare against an upper case name, without copying the field
+static bool
+field_is(const char* field, size_t len, const char* name)
+{
+    size_t i = 0;
+    for (; i < len && name[i] != '\0'; i++) {
+        if (toupper((unsigned char)field[i]) != name[i]) return false;
+    }
+    return i == len && name[i] == '\0';
+}
+
+static device_log::level_t
+level_for_field(const char* field, size_t len)
+{
+    if (field_is(field, len, "E") || field_is(field, len, "ERR") || field_is(field, len, "ERROR")) return device_log::LEVEL_ERROR;
+    if (field_is(field, len, "W") || field_is(field, len, "WRN") || field_is(field, len, "WARN") || field_is(field, len, "WARNING")) return device_log::LEVEL_WARN;
+    if (field_is(field, len, "I") || field_is(field, len, "INF") || field_is(field, len, "INFO")) return device_log::LEVEL_INFO;
+    if (field_is(field, len, "D") || field_is(field, len, "DBG") || field_is(field, len, "DEBUG") || field_is(field, len, "V") || field_is(field, len, "VERBOSE")) return device_log::LEVEL_DEBUG;
+    return device_log::LEVEL_UNKNOWN;
+}
+
+device_log::device_log() :
+    data_file(nullptr), index_file(nullptr), data_offset(0), since_index(0), last_index_ms(0), newest_ms(0)
+{
+}
+
+device_log::~device_log()
+{
+    close();
+}
+
+uint64_t
+device_log::now_ms()
+{
+    // anchored once so an NTP or manual clock step cannot put a record before the one it follows
+    static const uint64_t wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    static const std::chrono::steady_clock::time_point anchor = std::chrono::steady_clock::now();
+    return wall_ms + std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - anchor).count();
+}
+
+const char*
+device_log::level_name(level_t level)
+{
+    switch (level) {
+    case LEVEL_DEBUG: return "DEBUG";
+    case LEVEL_INFO: return "INFO";
+    case LEVEL_WARN: return "WARN";
+    case LEVEL_ERROR: return "ERROR";
+    default: return "-";
+    }
+}
+
+device_log::level_t
+device_log::level_for_name(const std::string& name)
+{
+    return level_for_field(name.data(), name.size());
+}
+
+// Accepts "[ts][level][module] text", "[ts] level module: text" and plain text.
+// Fields that cannot be recognised are left empty and the rest of the line is the message.
+// Only assigns into out, so an entry reused line after line stops allocating.
+bool
+device_log::parse_line(const std::string& line, entry* out)
+{
+    out->device_time = 0;
+    out->level = LEVEL_UNKNOWN;
+    out->module.clear();
+    out->message.clear();
+
+    size_t pos = 0;
+    bool have_ts = false;
+
+    while (pos < line.size()) {
+        while (pos < line.size() && line[pos] == ' ') pos++;
+        if (pos >= line.size() || line[pos] != '[') break;
+
+        size_t end = line.find(']', pos);
+        if (end == std::string::npos) break;
+
+        const char* field = line.data() + pos + 1;
+        size_t field_len = end - pos - 1;
+        level_t lvl = level_for_field(field, field_len);
+
+        if (!have_ts && is_timestamp(field, field_len)) {
+            out->device_time = (uint32_t)strtoul(field, nullptr, 10);
+            have_ts = true;
+        }
+        else if (out->level == LEVEL_UNKNOWN && lvl != LEVEL_UNKNOWN) {
+            out->level = lvl;
+        }
+        else if (out->module.empty()) {
+            out->module.assign(field, field_len);
+        }
+        pos = end + 1;
+    }
+
+    while (pos < line.size() && line[pos] == ' ') pos++;
+
+    // un-bracketed "LEVEL MODULE: text" / "MODULE: text" forms
+    if (out->level == LEVEL_UNKNOWN) {
+        size_t sp = line.find(' ', pos);
+        if (sp != std::string::npos) {
+            level_t lvl = level_for_field(line.data() + pos, sp - pos);
+            if (lvl != LEVEL_UNKNOWN) {
+                out->level = lvl;
+                pos = sp + 1;
+            }
+        }
+    }
+    if (out->module.empty()) {
+        size_t colon = line.find(':', pos);
+        size_t sp = line.find(' ', pos);
+        if (colon != std::string::npos && colon > pos && (sp == std::string::npos || colon < sp) && colon - pos <= 16) {
+            out->module.assign(line, pos, colon - pos);
+            pos = colon + 1;
+            while (pos < line.size() && line[pos] == ' ') pos++;
+        }
+    }
+
+    out->message.assign(line, std::min(pos, line.size()), std::string::npos);
+    if (out->module.size() > 0xff) out->module.resize(0xff);
+    if (out->message.size() > 0xffff) out->message.resize(0xffff);
+
+    return !out->message.empty() || !out->module.empty();
+}
+
+bool
+device_log::open(const std::string& base_path)
+{
+    close();
+
+    if (!repair_tail(base_path, &newest_ms)) return false;
+
+    data_file = fopen((base_path + ".dlog").c_str(), "ab");
+    index_file = fopen((base_path + ".didx").c_str(), "ab");
+    if (data_file == nullptr || index_file == nullptr) {
+        close();
+        return false;
+    }
+
+    seek64(data_file, 0, SEEK_END);
+    data_offset = tell64(data_file);
+    since_index = INDEX_EVERY_RECORDS; // index the first record of this session
+    last_index_ms = 0;
+    pending.reserve(MAX_LINE);
+    return true;
+}
+
+void
+device_log::close()
+{
+    if (data_file != nullptr) {
+        flush();
+        fclose(data_file);
+    }
+    if (index_file != nullptr) {
+        fclose(index_file);
+    }
+    data_file = nullptr;
+    index_file = nullptr;
+    pending.clear();
+}
+
+void
+device_log::flush()
+{
+    if (data_file != nullptr) fflush(data_file);
+    if (index_file != nullptr) fflush(index_file);
+}
+
+void
+device_log::feed(const uint8_t* payload, int size, uint64_t host_time_ms)
+{
+    for (int i = 0; i < size; i++) {
+        char c = (char)payload[i];
+
+        if (c == '\0' || c == '\r') continue;
+
+        if (c == '\n' || pending.size() >= MAX_LINE) {
+            if (parse_line(pending, &parsed)) {
+                parsed.host_time_ms = host_time_ms;
+                append(parsed);
+            }
+            pending.clear();
+            if (c == '\n') continue;
+        }
+        pending.push_back(c);
+    }
+}
+
+void
+device_log::append(const entry& e)
+{
+    if (data_file == nullptr) return;
+
+    // a clock set back between sessions must not break the ordering query() relies on
+    newest_ms = std::max(newest_ms, e.host_time_ms);
+
+    if (since_index >= INDEX_EVERY_RECORDS || newest_ms - last_index_ms >= INDEX_EVERY_MS) {
+        uint8_t idx[INDEX_ENTRY_SIZE];
+        put_le(&idx[0], newest_ms, 8);
+        put_le(&idx[8], data_offset, 8);
+        fwrite(idx, 1, sizeof(idx), index_file);
+        since_index = 0;
+        last_index_ms = newest_ms;
+    }
+
+    uint8_t hdr[RECORD_HEADER_SIZE];
+    put_le(&hdr[0], newest_ms, 8);
+    put_le(&hdr[8], e.device_time, 4);
+    hdr[12] = e.level;
+    hdr[13] = (uint8_t)e.module.size();
+    put_le(&hdr[14], e.message.size(), 2);
+
+    fwrite(hdr, 1, sizeof(hdr), data_file);
+    fwrite(e.module.data(), 1, e.module.size(), data_file);
+    fwrite(e.message.data(), 1, e.message.size(), data_file);
+
+    data_offset += sizeof(hdr) + e.module.size() + e.message.size();
+    since_index++;
+}
+
+int
+device_log::query(const std::string& base_path, const query_t& q, void (*cb)(const entry&, void*), void* ctx)
+{
+    FILE* data = fopen((base_path + ".dlog").c_str(), "rb");
+    if (data == nullptr) return -1;
+
+    // last index entry strictly before the start of the range is a safe place to begin scanning,
+    // binary searched in the file so a long lived store's index is never read whole
+    uint64_t start_offset = 0;
+    FILE* index = fopen((base_path + ".didx").c_str(), "rb");
+    if (index != nullptr) {
+        uint64_t lo = 0, hi = file_size(index) / INDEX_ENTRY_SIZE;
+        uint64_t host_ms, offset;
+        while (lo < hi) {
+            uint64_t mid = (lo + hi) / 2;
+            if (!read_index(index, mid, &host_ms, &offset)) break;
+            if (host_ms < q.from_ms) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo > 0 && read_index(index, lo - 1, &host_ms, &offset)) start_offset = offset;
+        fclose(index);
+    }
+
+    seek64(data, start_offset, SEEK_SET);
+
+    int matches = 0;
+    uint8_t hdr[RECORD_HEADER_SIZE];
+    std::vector<char> body(0xff + 0xffff);
+    entry e;
+
+    while (fread(hdr, 1, sizeof(hdr), data) == sizeof(hdr)) {
+        e.host_time_ms = get_le(&hdr[0], 8);
+        e.device_time = (uint32_t)get_le(&hdr[8], 4);
+        e.level = (level_t)hdr[12];
+        size_t module_len = hdr[13];
+        size_t message_len = (size_t)get_le(&hdr[14], 2);
+
+        if (fread(body.data(), 1, module_len + message_len, data) != module_len + message_len) break; // torn tail
+
+        if (e.host_time_ms > q.to_ms) break; // sorted, nothing later can match
+        if (e.host_time_ms < q.from_ms) continue;
+        if (q.min_level != LEVEL_UNKNOWN && e.level < q.min_level) continue;
+        if (!q.module.empty() && (module_len != q.module.size() || upper(std::string(body.data(), module_len)) != upper(q.module))) continue;
+
+        e.module.assign(body.data(), module_len);
+        e.message.assign(body.data() + module_len, message_len);
+        cb(e, ctx);
+        matches++;
+    }
+
+    fclose(data);
+    return matches;
+}
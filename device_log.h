@@ -0,0 +1,69 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Reassembles ASYNC_TEXT_LOG (0x6c09) payloads into lines and keeps them in an
+// append-only store: <base>.dlog holds the records, <base>.didx holds a sparse
+// (host time, file offset) index used to seek straight to a time range. Host times
+// never decrease within a store, so both files are sorted by them.
+class device_log
+{
+public:
+    enum level_t : uint8_t {
+        LEVEL_UNKNOWN = 0,
+        LEVEL_DEBUG,
+        LEVEL_INFO,
+        LEVEL_WARN,
+        LEVEL_ERROR
+    };
+
+    typedef struct {
+        uint64_t host_time_ms;   // now_ms() when the line completed, raised to the newest in the store
+        uint32_t device_time;    // timestamp field of the line, 0 if absent
+        level_t level;
+        std::string module;
+        std::string message;
+    } entry;
+
+    typedef struct {
+        uint64_t from_ms;        // inclusive, host time
+        uint64_t to_ms;          // inclusive, host time
+        level_t min_level;       // LEVEL_UNKNOWN matches everything
+        std::string module;      // empty matches every module
+    } query_t;
+
+    device_log();
+    ~device_log();
+
+    // cuts back a half written record left by a crash before appending
+    bool open(const std::string& base_path);
+    void close();
+    bool is_open() const { return data_file != nullptr; }
+
+    // feed the payload of one ASYNC_TEXT_LOG report, lines may span reports
+    void feed(const uint8_t* payload, int size, uint64_t host_time_ms);
+    void flush();
+
+    static bool parse_line(const std::string& line, entry* out);
+    static const char* level_name(level_t level);
+    static level_t level_for_name(const std::string& name);
+    // wall clock ms at the first call plus steady time since, never steps back
+    static uint64_t now_ms();
+
+    // scans a closed or open store, calls cb for every matching entry
+    static int query(const std::string& base_path, const query_t& q, void (*cb)(const entry&, void*), void* ctx);
+
+private:
+    void append(const entry& e);
+
+    FILE* data_file;
+    FILE* index_file;
+    std::string pending;
+    entry parsed;                // reused so its strings keep their capacity
+    uint64_t data_offset;
+    uint32_t since_index;
+    uint64_t last_index_ms;
+    uint64_t newest_ms;          // host time of the last record, carried over from earlier sessions
+};
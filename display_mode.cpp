@@ -0,0 +1,169 @@
+#include "display_mode.h"
+#include "protocol_codec.h"
+
+#include <algorithm>
+
+static const struct {
+    display_mode::mode_t mode;
+    const char* name;
+} MODE_NAMES[] = {
+    { display_mode::MODE_2D_1080_60, "2d" },
+    { display_mode::MODE_2D_1080_72, "2d-72" },
+    { display_mode::MODE_2D_1080_90, "2d-90" },
+    { display_mode::MODE_2D_1080_120, "2d-120" },
+    { display_mode::MODE_SBS_3840_60, "sbs" },
+    { display_mode::MODE_SBS_3840_72, "sbs-72" },
+    { display_mode::MODE_SBS_3840_90, "sbs-90" },
+    { display_mode::MODE_SBS_1920_60, "sbs-half" }
+};
+
+display_mode::display_mode(send_fn send, void* ctx, uint32_t timeout_ms, uint32_t max_retries) :
+    send(send), ctx(ctx), timeout(timeout_ms), max_retries(max_retries),
+    current_state(STATE_IDLE), current_mode(MODE_UNKNOWN), desired_mode(MODE_UNKNOWN), inflight_mode(MODE_UNKNOWN),
+    attempts(0), querying(false), counters()
+{
+}
+
+const char*
+display_mode::mode_name(mode_t mode)
+{
+    for (const auto& m : MODE_NAMES) {
+        if (m.mode == mode) return m.name;
+    }
+    return "unknown";
+}
+
+display_mode::mode_t
+display_mode::mode_for_name(const std::string& name)
+{
+    for (const auto& m : MODE_NAMES) {
+        if (name == m.name) return m.mode;
+    }
+    return MODE_UNKNOWN;
+}
+
+int
+display_mode::encode(mode_t mode, uint8_t* p_buf, int p_size)
+{
+    protocol_codec::disp_mode_request request;
+    request.mode = mode;
+    return protocol_codec::encode(request, p_buf, p_size);
+}
+
+bool
+display_mode::send_mode(mode_t mode, time_point now)
+{
+    uint8_t p_buf[4];
+    int p_size = encode(mode, p_buf, sizeof(p_buf));
+
+    counters.writes++;
+    if (send(ctx, protocol::W_DISP_MODE, p_buf, p_size) != 0) {
+        counters.failures++;
+        current_state = STATE_IDLE;
+        return false;
+    }
+
+    if (current_state != STATE_PENDING || inflight_mode != mode) {
+        first_sent = now;
+        attempts = 0;
+    }
+    inflight_mode = mode;
+    attempts++;
+    last_sent = now;
+    current_state = STATE_PENDING;
+    return true;
+}
+
+bool
+display_mode::request(mode_t mode, time_point now)
+{
+    if (mode == MODE_UNKNOWN) return false;
+
+    if (current_state == STATE_PENDING) {
+        if (desired_mode != inflight_mode) counters.coalesced++;
+        desired_mode = mode;
+        return true;
+    }
+
+    desired_mode = mode;
+    if (mode == current_mode) {
+        counters.skipped++;
+        return true;
+    }
+
+    return send_mode(mode, now);
+}
+
+bool
+display_mode::query(time_point now)
+{
+    if (current_state == STATE_PENDING) return false;
+
+    if (send(ctx, protocol::R_DISP_MODE, nullptr, 0) != 0) return false;
+    querying = true;
+    query_sent = now;
+    return true;
+}
+
+void
+display_mode::write_failed(time_point now)
+{
+    counters.failures++;
+    current_state = STATE_IDLE;
+    current_mode = MODE_UNKNOWN; // the glasses may or may not have switched
+
+    if (desired_mode == inflight_mode) desired_mode = MODE_UNKNOWN;
+    else send_mode(desired_mode, now);
+}
+
+void
+display_mode::on_rsp(const protocol::parsed_rsp& rsp, time_point now)
+{
+    if (!rsp.valid) return;
+
+    protocol_codec::disp_mode_reply reply;
+    if (rsp.msgId == protocol::R_DISP_MODE && protocol_codec::decode(rsp.payload, rsp.payload_size, &reply)) {
+        querying = false;
+        if (current_state != STATE_IDLE) return;
+        current_mode = (mode_t)reply.mode;
+        if (desired_mode == MODE_UNKNOWN) desired_mode = current_mode;
+        return;
+    }
+
+    if (rsp.msgId != protocol::W_DISP_MODE || current_state != STATE_PENDING) return;
+
+    if (rsp.status != 0) {
+        write_failed(now);
+        return;
+    }
+    current_state = STATE_IDLE;
+
+    double ms = std::chrono::duration<double, std::milli>(now - first_sent).count();
+    counters.confirmed++;
+    counters.last_ms = ms;
+    counters.total_ms += ms;
+    counters.max_ms = std::max(counters.max_ms, ms);
+    counters.min_ms = counters.confirmed == 1 ? ms : std::min(counters.min_ms, ms);
+    current_mode = inflight_mode;
+
+    if (desired_mode != current_mode) {
+        send_mode(desired_mode, now);
+    }
+}
+
+void
+display_mode::poll(time_point now)
+{
+    if (querying && now - query_sent >= timeout) querying = false;
+
+    if (current_state != STATE_PENDING || now - last_sent < timeout) return;
+
+    if (attempts > max_retries) {
+        write_failed(now);
+        return;
+    }
+
+    // the same mode again, so a late reply to an earlier attempt still confirms what was sent
+    counters.retries++;
+    send_mode(inflight_mode, now);
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "protocol.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+// Display mode state machine for the control interface. Requests made while a
+// W_DISP_MODE write is outstanding are coalesced (the latest one wins), writes for
+// the mode the glasses are already in are skipped, and a write is only retried
+// (with the same mode) when its reply does not arrive in time.
+class display_mode
+{
+public:
+    enum mode_t : uint8_t {
+        MODE_UNKNOWN = 0x00,
+        MODE_2D_1080_60 = 0x01,
+        MODE_SBS_3840_60 = 0x03,
+        MODE_SBS_3840_72 = 0x04,
+        MODE_2D_1080_72 = 0x05,
+        MODE_SBS_1920_60 = 0x08,
+        MODE_SBS_3840_90 = 0x09,
+        MODE_2D_1080_90 = 0x0a,
+        MODE_2D_1080_120 = 0x0b
+    };
+
+    enum state_t {
+        STATE_IDLE,
+        STATE_PENDING    // write sent, waiting for its reply
+    };
+
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    // returns 0 on success, like write_control
+    typedef int (*send_fn)(void* ctx, uint16_t msgId, const uint8_t* p_buf, int p_size);
+
+    typedef struct {
+        uint32_t writes;
+        uint32_t confirmed;
+        uint32_t skipped;        // already in the requested mode
+        uint32_t coalesced;      // replaced by a newer request before being sent
+        uint32_t retries;
+        uint32_t failures;
+        double last_ms;
+        double min_ms;
+        double max_ms;
+        double total_ms;
+    } stats_t;
+
+    display_mode(send_fn send, void* ctx, uint32_t timeout_ms = 300, uint32_t max_retries = 3);
+
+    static const char* mode_name(mode_t mode);
+    static mode_t mode_for_name(const std::string& name);
+    static int encode(mode_t mode, uint8_t* p_buf, int p_size);
+
+    bool request(mode_t mode, time_point now);
+    bool query(time_point now);
+    // feed every response read from the control interface
+    void on_rsp(const protocol::parsed_rsp& rsp, time_point now);
+    // resends or gives up on a write whose reply is overdue, gives up on an overdue query
+    void poll(time_point now);
+
+    mode_t current() const { return current_mode; }
+    mode_t target() const { return desired_mode; }
+    state_t state() const { return current_state; }
+    // no write or query waiting for its reply
+    bool idle() const { return current_state == STATE_IDLE && !querying; }
+    bool settled() const { return idle() && current_mode != MODE_UNKNOWN && desired_mode == current_mode; }
+    const stats_t& stats() const { return counters; }
+
+private:
+    bool send_mode(mode_t mode, time_point now);
+    // the write for inflight_mode failed, go on with a request that came in behind it
+    void write_failed(time_point now);
+
+    send_fn send;
+    void* ctx;
+    std::chrono::milliseconds timeout;
+    uint32_t max_retries;
+
+    state_t current_state;
+    mode_t current_mode;
+    mode_t desired_mode;
+    mode_t inflight_mode;
+    uint32_t attempts;
+    time_point first_sent;
+    time_point last_sent;
+    bool querying;
+    time_point query_sent;
+    stats_t counters;
+};
@@ -0,0 +1,155 @@
+#include "event_bus.h"
+#include "protocol_codec.h"
+
+event_bus::event_bus(size_t capacity, uint32_t spin_iterations) :
+    enqueue_pos(0), dequeue_pos(0), sleeping(false), published_count(0), dropped_count(0),
+    spin_iterations(spin_iterations), running(false), thread_init(nullptr), thread_init_ctx(nullptr)
+{
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+
+    cells.reset(new cell[size]);
+    for (size_t i = 0; i < size; i++)
+        cells[i].seq.store(i, std::memory_order_relaxed);
+    mask = size - 1;
+}
+
+event_bus::~event_bus()
+{
+    stop();
+}
+
+bool
+event_bus::decode_button(const protocol::parsed_rsp& rsp, uint8_t* button, uint8_t* brightness)
+{
+    protocol_codec::button_pressed pressed;
+    if (rsp.msgId != protocol::P_BUTTON_PRESSED || !protocol_codec::decode(rsp.payload, rsp.payload_size, &pressed)) return false;
+
+    *button = pressed.button;
+    *brightness = pressed.brightness;
+    return true;
+}
+
+bool
+event_bus::subscribe(uint16_t msgId, callback_fn cb, void* ctx)
+{
+    if (running.load() || cb == nullptr) return false;
+
+    subscription s = { msgId, cb, ctx };
+    subscriptions.push_back(s);
+    return true;
+}
+
+bool
+event_bus::start()
+{
+    if (running.exchange(true)) return false;
+
+    dispatcher = std::thread(&event_bus::run, this);
+    return true;
+}
+
+void
+event_bus::stop()
+{
+    if (!running.exchange(false)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake.notify_one();
+    }
+    dispatcher.join();
+}
+
+bool
+event_bus::publish(const protocol::parsed_rsp& rsp, std::chrono::steady_clock::time_point received)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    cell* c;
+
+    while (true) {
+        c = &cells[pos & mask];
+        size_t seq = c->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        }
+        else if (diff < 0) {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    c->data.rsp = rsp;
+    c->data.received = received;
+    c->data.button = 0;
+    c->data.brightness = 0;
+    decode_button(rsp, &c->data.button, &c->data.brightness);
+    c->seq.store(pos + 1, std::memory_order_release);
+
+    published_count.fetch_add(1, std::memory_order_relaxed);
+
+    // pairs with the fence in run(): either the dispatcher sees this event before
+    // sleeping or we see it sleeping and wake it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake.notify_one();
+    }
+    return true;
+}
+
+bool
+event_bus::pop(event* out)
+{
+    cell* c = &cells[dequeue_pos & mask];
+    size_t seq = c->seq.load(std::memory_order_acquire);
+
+    if (seq != dequeue_pos + 1) return false;
+
+    *out = c->data;
+    c->seq.store(dequeue_pos + mask + 1, std::memory_order_release);
+    dequeue_pos++;
+    return true;
+}
+
+void
+event_bus::run()
+{
+    event e;
+    uint32_t idle = 0;
+
+    if (thread_init != nullptr) thread_init(thread_init_ctx);
+
+    while (true) {
+        if (pop(&e)) {
+            idle = 0;
+            uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - e.received).count();
+            dispatch_latency.record(ns);
+
+            for (const subscription& s : subscriptions) {
+                if (s.msgId == ALL_MESSAGES || s.msgId == e.rsp.msgId) s.cb(e, s.ctx);
+            }
+            continue;
+        }
+
+        if (!running.load(std::memory_order_relaxed)) break;
+
+        // spin a little for latency, then sleep until a publisher wakes us
+        if (++idle < spin_iterations) continue;
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (cells[dequeue_pos & mask].seq.load(std::memory_order_acquire) != dequeue_pos + 1 && running.load()) {
+            wake.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "protocol.h"
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Delivers control interface pushes (P_BUTTON_PRESSED, heartbeats, ASYNC_TEXT_LOG...)
+// to subscribers on a dedicated dispatcher thread. publish() is lock-free and may be
+// called from any number of reader threads; it never blocks on a slow subscriber, a
+// full queue drops the event and counts it instead.
+class event_bus
+{
+public:
+    static const uint16_t ALL_MESSAGES = protocol::INVALID_MSG_ID;
+
+    typedef struct {
+        protocol::parsed_rsp rsp;
+        std::chrono::steady_clock::time_point received;
+        // P_BUTTON_PRESSED only, see decode_button()
+        uint8_t button;
+        uint8_t brightness;
+    } event;
+
+    typedef void (*callback_fn)(const event& e, void* ctx);
+
+    // capacity is rounded up to a power of two
+    explicit event_bus(size_t capacity = 1024, uint32_t spin_iterations = 2000);
+    ~event_bus();
+
+    // subscriptions are fixed once the dispatcher is running
+    bool subscribe(uint16_t msgId, callback_fn cb, void* ctx);
+    bool start();
+    void stop();
+
+    bool publish(const protocol::parsed_rsp& rsp, std::chrono::steady_clock::time_point received);
+
+    // button id and brightness level 0-7 of a P_BUTTON_PRESSED payload
+    static bool decode_button(const protocol::parsed_rsp& rsp, uint8_t* button, uint8_t* brightness);
+
+    uint64_t published() const { return published_count.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return dropped_count.load(std::memory_order_relaxed); }
+    // receive timestamp to callback entry, per delivered event
+    const latency_histogram& latency() const { return dispatch_latency; }
+
+    // runs on the dispatcher thread before the first event, e.g. to apply an rt_thread config
+    void set_thread_init(void (*init)(void* ctx), void* ctx) { thread_init = init; thread_init_ctx = ctx; }
+
+private:
+    typedef struct {
+        uint16_t msgId;
+        callback_fn cb;
+        void* ctx;
+    } subscription;
+
+    // Vyukov bounded queue cell, seq tells producers and the consumer whose turn it is
+    typedef struct {
+        std::atomic<size_t> seq;
+        event data;
+    } cell;
+
+    bool pop(event* out);
+    void run();
+
+    std::unique_ptr<cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) size_t dequeue_pos;
+    alignas(64) std::atomic<bool> sleeping;
+    std::atomic<uint64_t> published_count;
+    std::atomic<uint64_t> dropped_count;
+
+    uint32_t spin_iterations;
+    std::vector<subscription> subscriptions;
+    std::atomic<bool> running;
+    std::thread dispatcher;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    latency_histogram dispatch_latency;
+    void (*thread_init)(void* ctx);
+    void* thread_init_ctx;
+};
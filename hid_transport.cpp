@@ -0,0 +1,18 @@
+#include "hid_transport.h"
+#ifdef _WIN32
+#include "hidapi-win/include/hidapi.h"
+#else
+#include <hidapi/hidapi.h>
+#endif
+
+int
+hid_transport::write(const uint8_t* data, size_t length)
+{
+    return hid_write(device, data, length);
+}
+
+int
+hid_transport::read(uint8_t* data, size_t length, int timeout_ms)
+{
+    return hid_read_timeout(device, data, length, timeout_ms);
+}
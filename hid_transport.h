@@ -0,0 +1,20 @@
+#pragma once
+#include "transport.h"
+
+struct hid_device_;
+typedef struct hid_device_ hid_device;
+
+// transport over one hidapi interface of the glasses
+class hid_transport : public transport
+{
+public:
+    explicit hid_transport(hid_device* device) : device(device) {}
+
+    int write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t length, int timeout_ms) override;
+
+    hid_device* handle() const { return device; }
+
+private:
+    hid_device* device;
+};
@@ -0,0 +1,149 @@
+#include "imu.h"
+
+#include <stdlib.h>
+#include <string>
+
+const uint8_t SIGNATURE[] = { 0x01, 0x02 };
+const int TEMP_OFS = 2;
+const int TS_OFS = 4;
+const int GYRO_OFS = 12;     // 2 byte multiplier, 4 byte divisor, 3x 24-bit values
+const int ACCEL_OFS = 27;    // 2 byte multiplier, 4 byte divisor, 3x 24-bit values
+const int MAG_OFS = 42;      // 2 byte multiplier, 4 byte divisor, 3x 16-bit values, big-endian
+
+static int32_t
+get_s24(const uint8_t* b)
+{
+    int32_t v = b[0] | (b[1] << 8) | (b[2] << 16);
+    return (v & 0x800000) ? v - 0x1000000 : v;
+}
+
+static int32_t
+get_s16(const uint8_t* b)
+{
+    return (int16_t)(b[0] | (b[1] << 8));
+}
+
+static int32_t
+get_s16_be(const uint8_t* b)
+{
+    return (int16_t)((b[0] << 8) | b[1]);
+}
+
+static int32_t
+get_s32(const uint8_t* b)
+{
+    return (int32_t)((uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24));
+}
+
+static int32_t
+get_s32_be(const uint8_t* b)
+{
+    return (int32_t)(((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3]);
+}
+
+static float
+scaled(int32_t value, int32_t mult, int32_t div)
+{
+    return div == 0 ? 0.0f : (float)value * (float)mult / (float)div;
+}
+
+bool
+imu::is_sample(const uint8_t* buffer_in, int size)
+{
+    return buffer_in != nullptr && size >= REPORT_SIZE && buffer_in[0] == SIGNATURE[0] && buffer_in[1] == SIGNATURE[1];
+}
+
+bool
+imu::parse_sample(const uint8_t* buffer_in, int size, sample* out)
+{
+    if (!is_sample(buffer_in, size)) return false;
+
+    out->temperature = (float)get_s16(&buffer_in[TEMP_OFS]) / 132.48f + 25.0f;
+
+    out->timestamp = 0;
+    for (int i = 7; i >= 0; i--)
+        out->timestamp = (out->timestamp << 8) | buffer_in[TS_OFS + i];
+
+    int32_t mult = get_s16(&buffer_in[GYRO_OFS]);
+    int32_t div = get_s32(&buffer_in[GYRO_OFS + 2]);
+    for (int i = 0; i < 3; i++)
+        out->gyro[i] = scaled(get_s24(&buffer_in[GYRO_OFS + 6 + 3 * i]), mult, div);
+
+    mult = get_s16(&buffer_in[ACCEL_OFS]);
+    div = get_s32(&buffer_in[ACCEL_OFS + 2]);
+    for (int i = 0; i < 3; i++)
+        out->accel[i] = scaled(get_s24(&buffer_in[ACCEL_OFS + 6 + 3 * i]), mult, div);
+
+    mult = get_s16_be(&buffer_in[MAG_OFS]);
+    div = get_s32_be(&buffer_in[MAG_OFS + 2]);
+    for (int i = 0; i < 3; i++)
+        out->mag[i] = scaled(get_s16_be(&buffer_in[MAG_OFS + 6 + 2 * i]), mult, div);
+
+    return true;
+}
+
+void
+imu::default_calibration(calibration* cal)
+{
+    for (int i = 0; i < 3; i++) {
+        cal->gyro_bias[i] = 0.0f;
+        cal->accel_bias[i] = 0.0f;
+        cal->mag_bias[i] = 0.0f;
+        cal->gyro_scale[i] = 1.0f;
+        cal->accel_scale[i] = 1.0f;
+        cal->mag_scale[i] = 1.0f;
+    }
+}
+
+// finds "key": [a, b, c] after start, leaves out untouched if the key is missing
+static bool
+find_vec3(const std::string& json, size_t start, const char* key, float* out)
+{
+    size_t pos = json.find(std::string("\"") + key + "\"", start);
+    if (pos == std::string::npos) return false;
+
+    pos = json.find('[', pos);
+    if (pos == std::string::npos) return false;
+
+    const char* p = json.c_str() + pos + 1;
+    float v[3];
+    for (int i = 0; i < 3; i++) {
+        char* end = nullptr;
+        v[i] = strtof(p, &end);
+        if (end == p) return false;
+        p = end;
+        while (*p == ' ' || *p == ',' || *p == '\n' || *p == '\r' || *p == '\t') p++;
+    }
+
+    for (int i = 0; i < 3; i++)
+        out[i] = v[i];
+    return true;
+}
+
+bool
+imu::load_calibration(const char* json, size_t len, calibration* cal)
+{
+    std::string text(json, len);
+
+    size_t start = text.find("\"device_1\"");
+    if (start == std::string::npos) start = 0;
+
+    bool found = false;
+    found |= find_vec3(text, start, "gyro_bias", cal->gyro_bias);
+    found |= find_vec3(text, start, "scale_gyro", cal->gyro_scale);
+    found |= find_vec3(text, start, "accel_bias", cal->accel_bias);
+    found |= find_vec3(text, start, "scale_accel", cal->accel_scale);
+    found |= find_vec3(text, start, "mag_bias", cal->mag_bias);
+    found |= find_vec3(text, start, "scale_mag", cal->mag_scale);
+    return found;
+}
+
+void
+imu::apply_calibration(const calibration& cal, sample* s)
+{
+    for (int i = 0; i < 3; i++) {
+        s->gyro[i] = (s->gyro[i] - cal.gyro_bias[i]) * cal.gyro_scale[i];
+        s->accel[i] = (s->accel[i] - cal.accel_bias[i]) * cal.accel_scale[i];
+        s->mag[i] = (s->mag[i] - cal.mag_bias[i]) * cal.mag_scale[i];
+    }
+}
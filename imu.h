@@ -0,0 +1,37 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Decoder for the 64 byte IMU reports streamed on interface 3 after START_IMU_DATA.
+class imu
+{
+public:
+    typedef struct {
+        uint64_t timestamp;      // device clock, ns
+        float gyro[3];           // deg/s
+        float accel[3];          // g
+        float mag[3];            // gauss
+        float temperature;       // deg C
+    } sample;
+
+    // per axis, applied as (raw - bias) * scale
+    typedef struct {
+        float gyro_bias[3];
+        float gyro_scale[3];
+        float accel_bias[3];
+        float accel_scale[3];
+        float mag_bias[3];
+        float mag_scale[3];
+    } calibration;
+
+    static const int REPORT_SIZE = 64;
+    static const int NOMINAL_RATE_HZ = 1000;
+
+    static bool is_sample(const uint8_t* buffer_in, int size);
+    static bool parse_sample(const uint8_t* buffer_in, int size, sample* out);
+
+    static void default_calibration(calibration* cal);
+    // reads the IMU section of the calibration json returned by CAL_DATA_GET_NEXT_SEGMENT
+    static bool load_calibration(const char* json, size_t len, calibration* cal);
+    static void apply_calibration(const calibration& cal, sample* s);
+};
@@ -0,0 +1,156 @@
+#include "imu_decimator.h"
+
+#include <math.h>
+
+const int TAPS_PER_FACTOR = 16;
+const int MAX_TAPS = 1023;
+const int MAX_STREAMS = 32;          // push() reports outputs as bits of a uint32_t
+const double CUTOFF = 0.4;           // of the output rate, leaves room for the transition band
+const double PI = 3.14159265358979323846;
+
+imu_decimator::output::output(int factor, size_t ring_capacity) :
+    factor(factor), phase(0), taps_used(1), len(LANES), pos(0), ring(ring_capacity), dropped(0)
+{
+}
+
+imu_decimator::imu_decimator(float input_hz) :
+    input_hz(input_hz), primed(false)
+{
+}
+
+int
+imu_decimator::add_stream(float output_hz, size_t ring_capacity)
+{
+    if (output_hz <= 0 || input_hz <= 0 || (int)outputs.size() >= MAX_STREAMS) return -1;
+
+    int factor = (int)floor(input_hz / output_hz + 0.5f);
+    if (factor < 1) factor = 1;
+
+    std::unique_ptr<output> out(new output(factor, ring_capacity));
+    if (factor > 1) design_lowpass(factor, out.get());
+
+    outputs.push_back(std::move(out));
+    return (int)outputs.size() - 1;
+}
+
+// Blackman windowed sinc with unity DC gain, so gravity and biases pass unchanged
+void
+imu_decimator::design_lowpass(int factor, output* out)
+{
+    int taps = TAPS_PER_FACTOR * factor + 1;
+    if (taps > MAX_TAPS) taps = MAX_TAPS;
+
+    out->taps_used = taps;
+    out->len = (taps + LANES - 1) / LANES * LANES;
+    out->coeff.assign(out->len, 0.0f);
+    out->history.assign((size_t)CHANNELS * 2 * out->len, 0.0f);
+    out->stamps.assign(out->len, 0);
+
+    double fc = CUTOFF / factor;
+    double m = taps - 1;
+    std::vector<double> h(taps);
+    double sum = 0;
+
+    for (int n = 0; n < taps; n++) {
+        double x = n - m / 2;
+        double sinc = x == 0 ? 2 * fc : sin(2 * PI * fc * x) / (PI * x);
+        double w = 0.42 - 0.5 * cos(2 * PI * n / m) + 0.08 * cos(4 * PI * n / m);
+        h[n] = sinc * w;
+        sum += h[n];
+    }
+
+    // zero padding goes on the oldest end, the newest sample always meets coeff[len - 1]
+    for (int n = 0; n < taps; n++) {
+        out->coeff[out->len - taps + n] = (float)(h[n] / sum);
+    }
+}
+
+// independent partial sums per lane, so the loop vectorizes without relaxed float semantics
+float
+imu_decimator::dot(const float* a, const float* b, int len)
+{
+    float acc[LANES] = { 0 };
+    for (int i = 0; i < len; i += LANES) {
+        for (int j = 0; j < LANES; j++) {
+            acc[j] += a[i + j] * b[i + j];
+        }
+    }
+
+    float sum = 0;
+    for (int j = 0; j < LANES; j++) sum += acc[j];
+    return sum;
+}
+
+void
+imu_decimator::store(output* out, const float* values, uint64_t timestamp)
+{
+    out->pos = out->pos + 1 == out->len ? 0 : out->pos + 1;
+
+    float* h = out->history.data();
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        h[ch * 2 * out->len + out->pos] = values[ch];
+        h[ch * 2 * out->len + out->pos + out->len] = values[ch];
+    }
+    out->stamps[out->pos] = timestamp;
+}
+
+uint32_t
+imu_decimator::push(const imu::sample& s)
+{
+    float values[CHANNELS] = {
+        s.gyro[0], s.gyro[1], s.gyro[2],
+        s.accel[0], s.accel[1], s.accel[2],
+        s.mag[0], s.mag[1], s.mag[2],
+        s.temperature
+    };
+    uint32_t produced = 0;
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+        output* out = outputs[i].get();
+
+        if (out->factor == 1) {
+            if (out->ring.push(s)) produced |= 1u << i;
+            else out->dropped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (!primed) {
+            // fill the window with the first sample instead of ramping up from zero,
+            // timestamps are extrapolated back at the nominal rate
+            uint64_t period_ns = (uint64_t)(1e9 / input_hz);
+            for (int k = out->len - 1; k >= 0; k--) {
+                uint64_t back = k * period_ns;
+                store(out, values, s.timestamp > back ? s.timestamp - back : 0);
+            }
+        }
+        else {
+            store(out, values, s.timestamp);
+        }
+
+        if (++out->phase < out->factor) continue;
+        out->phase = 0;
+
+        float filtered[CHANNELS];
+        const float* window = out->history.data() + out->pos + 1;
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            filtered[ch] = dot(out->coeff.data(), window + ch * 2 * out->len, out->len);
+        }
+
+        // linear phase: the output describes the input (taps - 1) / 2 samples back
+        int delay = (out->taps_used - 1) / 2;
+        imu::sample o;
+        o.timestamp = out->stamps[(out->pos + out->len - delay) % out->len];
+        for (int a = 0; a < 3; a++) {
+            o.gyro[a] = filtered[a];
+            o.accel[a] = filtered[3 + a];
+            o.mag[a] = filtered[6 + a];
+        }
+        o.temperature = filtered[9];
+
+        if (out->ring.push(o)) produced |= 1u << i;
+        else out->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    primed = true;
+    return produced;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "imu.h"
+#include "spsc_ring.h"
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Fans one decoded IMU stream out to several output rates. Each output is an integer
+// decimation of the input behind a linear phase low-pass FIR, evaluated only at the
+// output instants, and has its own ring so a 50 Hz consumer is woken 50 times a second.
+// push() must be called from one thread; each ring has a single reader.
+class imu_decimator
+{
+public:
+    static const int CHANNELS = 10;      // gyro xyz, accel xyz, mag xyz, temperature
+    static const int LANES = 8;          // taps are padded to a multiple of this
+
+    explicit imu_decimator(float input_hz);
+
+    // call before the first push(); rounds to the nearest integer decimation of input_hz,
+    // returns the stream index or -1 if output_hz is not positive
+    int add_stream(float output_hz, size_t ring_capacity);
+
+    // filters one input sample, returns a bit mask of the streams that produced an output
+    uint32_t push(const imu::sample& s);
+
+    int streams() const { return (int)outputs.size(); }
+    spsc_ring<imu::sample>& ring(int stream) { return outputs[stream]->ring; }
+    int factor(int stream) const { return outputs[stream]->factor; }
+    float rate(int stream) const { return input_hz / outputs[stream]->factor; }
+    int taps(int stream) const { return outputs[stream]->taps_used; }
+    // outputs lost because that stream's ring was full
+    uint64_t dropped(int stream) const { return outputs[stream]->dropped.load(std::memory_order_relaxed); }
+
+private:
+    struct output {
+        output(int factor, size_t ring_capacity);
+
+        int factor;
+        int phase;
+        int taps_used;             // real taps, the rest of coeff is zero padding
+        int len;                   // padded length, multiple of LANES
+        int pos;                   // newest sample in history
+        std::vector<float> coeff;  // oldest to newest
+        std::vector<float> history; // per channel, 2 * len so every window is contiguous
+        std::vector<uint64_t> stamps;
+        spsc_ring<imu::sample> ring;
+        std::atomic<uint64_t> dropped;
+    };
+
+    static void design_lowpass(int factor, output* out);
+    static float dot(const float* a, const float* b, int len);
+    static void store(output* out, const float* values, uint64_t timestamp);
+
+    float input_hz;
+    bool primed;
+    std::vector<std::unique_ptr<output>> outputs;
+};
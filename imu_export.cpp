@@ -0,0 +1,455 @@
+#include "imu_export.h"
+
+#include <string.h>
+#include <zlib.h>
+
+const uint8_t MAGIC[] = { 'R', 'U', 'I', 'M', 'U', 0x02, 0x00, 0x00 };
+const uint8_t BLOCK_MAGIC[] = { 'R', 'U', 'I', 'B' };
+const uint8_t TAIL_MAGIC[] = { 'R', 'U', 'I', 'M', 'U', 'E', 'N', 'D' };
+const int HEADER_SIZE = 8 + 4 + 4;
+const int BLOCK_HEADER_SIZE = 4 + 4 + 4 + 4 + 4 + 8 + 8;
+const int INDEX_ENTRY_SIZE = 4 + 4 + 8 + 4 + 4 + 8 + 8;
+const int TAIL_SIZE = 8 + 4 + 4 + 8;
+
+static void
+put_le(uint8_t* buf, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+get_le(const uint8_t* buf, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | buf[i];
+    return value;
+}
+
+static int
+seek64(FILE* f, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, origin);
+#else
+    return fseeko(f, (off_t)offset, origin);
+#endif
+}
+
+static uint64_t
+tell64(FILE* f)
+{
+#ifdef _WIN32
+    return (uint64_t)_ftelli64(f);
+#else
+    return (uint64_t)ftello(f);
+#endif
+}
+
+// groups byte k of every element together, float exponents compress far better that way
+static void
+shuffle(const uint8_t* in, uint8_t* out, size_t count, size_t width)
+{
+    for (size_t i = 0; i < count; i++)
+        for (size_t b = 0; b < width; b++)
+            out[b * count + i] = in[i * width + b];
+}
+
+static void
+unshuffle(const uint8_t* in, uint8_t* out, size_t count, size_t width)
+{
+    for (size_t i = 0; i < count; i++)
+        for (size_t b = 0; b < width; b++)
+            out[i * width + b] = in[b * count + i];
+}
+
+// the index grows by one entry per channel per chunk on the writer thread, this covers
+// about an hour at 1 kHz with the default chunk before it has to grow
+const size_t INDEX_RESERVE = 1024 * imu_export::CHANNEL_COUNT;
+
+imu_export::imu_export() :
+    file(nullptr), chunk_samples(0), total_samples(0), filling(0), queued(nullptr), stopping(false), failed(false), offset(0)
+{
+}
+
+imu_export::~imu_export()
+{
+    close();
+}
+
+const char*
+imu_export::channel_name(int channel)
+{
+    static const char* names[CHANNEL_COUNT] = {
+        "timestamp",
+        "gyro_x", "gyro_y", "gyro_z",
+        "accel_x", "accel_y", "accel_z",
+        "mag_x", "mag_y", "mag_z",
+        "temperature"
+    };
+    return (channel >= 0 && channel < CHANNEL_COUNT) ? names[channel] : "unknown";
+}
+
+bool
+imu_export::open(const std::string& path, uint32_t chunk_samples)
+{
+    close();
+
+    if (chunk_samples == 0) return false;
+
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+
+    this->chunk_samples = chunk_samples;
+    total_samples = 0;
+    index.clear();
+    index.reserve(INDEX_RESERVE);
+
+    // the chunk buffers are sized once here, add() never allocates
+    for (chunk& c : chunks) {
+        c.rows = 0;
+        c.timestamps.assign(chunk_samples, 0);
+        for (int ch = CH_GYRO_X; ch < CHANNEL_COUNT; ch++)
+            c.columns[ch].assign(chunk_samples, 0.0f);
+    }
+    filling = 0;
+    raw_buf.resize(chunk_samples * sizeof(uint64_t));
+    shuffle_buf.resize(chunk_samples * sizeof(uint64_t));
+    zip_buf.resize(compressBound((uLong)raw_buf.size()));
+
+    uint8_t hdr[HEADER_SIZE];
+    memcpy(hdr, MAGIC, sizeof(MAGIC));
+    put_le(&hdr[8], CHANNEL_COUNT, 4);
+    put_le(&hdr[12], chunk_samples, 4);
+    if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    offset = sizeof(hdr);
+
+    queued = nullptr;
+    stopping = false;
+    failed = false;
+    writer = std::thread(&imu_export::write_chunks, this);
+    return true;
+}
+
+bool
+imu_export::add(const imu::sample& s)
+{
+    if (file == nullptr) return false;
+
+    chunk& c = chunks[filling];
+    c.timestamps[c.rows] = s.timestamp;
+    for (int i = 0; i < 3; i++) {
+        c.columns[CH_GYRO_X + i][c.rows] = s.gyro[i];
+        c.columns[CH_ACCEL_X + i][c.rows] = s.accel[i];
+        c.columns[CH_MAG_X + i][c.rows] = s.mag[i];
+    }
+    c.columns[CH_TEMPERATURE][c.rows] = s.temperature;
+
+    c.rows++;
+    total_samples++;
+
+    if (c.rows == chunk_samples) return hand_off();
+    return !failed.load(std::memory_order_relaxed);
+}
+
+bool
+imu_export::hand_off()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    cv.wait(guard, [this] { return queued == nullptr; });
+
+    queued = &chunks[filling];
+    filling = 1 - filling;
+    chunks[filling].rows = 0;
+    cv.notify_all();
+    return !failed.load(std::memory_order_relaxed);
+}
+
+void
+imu_export::write_chunks()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        cv.wait(guard, [this] { return queued != nullptr || stopping; });
+        if (queued == nullptr) return;
+
+        // the reader keeps filling the other chunk meanwhile
+        chunk* c = queued;
+        guard.unlock();
+        bool ok = flush_chunk(*c);
+        guard.lock();
+
+        if (!ok) failed = true;
+        queued = nullptr;
+        cv.notify_all();
+    }
+}
+
+bool
+imu_export::write_block(int channel, const uint8_t* raw, uint32_t raw_size, uint32_t samples, uint64_t first_ts, uint64_t last_ts)
+{
+    uLongf zip_size = (uLongf)zip_buf.size();
+    const uint8_t* out = zip_buf.data();
+
+    if (compress2(zip_buf.data(), &zip_size, raw, raw_size, Z_BEST_SPEED) != Z_OK || zip_size >= raw_size) {
+        out = raw;
+        zip_size = raw_size;
+    }
+
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+    memcpy(hdr, BLOCK_MAGIC, sizeof(BLOCK_MAGIC));
+    put_le(&hdr[4], channel, 4);
+    put_le(&hdr[8], samples, 4);
+    put_le(&hdr[12], zip_size, 4);
+    put_le(&hdr[16], raw_size, 4);
+    put_le(&hdr[20], first_ts, 8);
+    put_le(&hdr[28], last_ts, 8);
+    if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr) || fwrite(out, 1, zip_size, file) != zip_size) return false;
+
+    chunk_info info;
+    info.channel = channel;
+    info.samples = samples;
+    info.offset = offset + sizeof(hdr);
+    info.stored_size = (uint32_t)zip_size;
+    info.raw_size = raw_size;
+    info.first_ts = first_ts;
+    info.last_ts = last_ts;
+    index.push_back(info);
+
+    offset += sizeof(hdr) + zip_size;
+    return true;
+}
+
+bool
+imu_export::flush_chunk(const chunk& c)
+{
+    uint32_t rows = c.rows;
+    if (rows == 0) return true;
+
+    uint64_t first_ts = c.timestamps[0];
+    uint64_t last_ts = c.timestamps[rows - 1];
+
+    // timestamps: first value absolute, then deltas
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < rows; i++) {
+        put_le(&raw_buf[i * 8], c.timestamps[i] - prev, 8);
+        prev = c.timestamps[i];
+    }
+    shuffle(raw_buf.data(), shuffle_buf.data(), rows, 8);
+    bool ok = write_block(CH_TIMESTAMP, shuffle_buf.data(), rows * 8, rows, first_ts, last_ts);
+
+    for (int ch = CH_GYRO_X; ok && ch < CHANNEL_COUNT; ch++) {
+        shuffle((const uint8_t*)c.columns[ch].data(), shuffle_buf.data(), rows, sizeof(float));
+        ok = write_block(ch, shuffle_buf.data(), rows * sizeof(float), rows, first_ts, last_ts);
+    }
+    return ok;
+}
+
+bool
+imu_export::close()
+{
+    if (file == nullptr) return true;
+
+    // the partly filled chunk goes the same way, then the writer drains and stops
+    if (chunks[filling].rows > 0) hand_off();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        cv.notify_all();
+    }
+    writer.join();
+
+    bool ok = !failed.load(std::memory_order_relaxed);
+
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    for (const chunk_info& info : index) {
+        put_le(&entry[0], info.channel, 4);
+        put_le(&entry[4], info.samples, 4);
+        put_le(&entry[8], info.offset, 8);
+        put_le(&entry[16], info.stored_size, 4);
+        put_le(&entry[20], info.raw_size, 4);
+        put_le(&entry[24], info.first_ts, 8);
+        put_le(&entry[32], info.last_ts, 8);
+        ok = ok && fwrite(entry, 1, sizeof(entry), file) == sizeof(entry);
+    }
+
+    uint8_t tail[TAIL_SIZE];
+    put_le(&tail[0], offset, 8);
+    put_le(&tail[8], index.size(), 4);
+    put_le(&tail[12], 0, 4);
+    memcpy(&tail[16], TAIL_MAGIC, sizeof(TAIL_MAGIC));
+    ok = ok && fwrite(tail, 1, sizeof(tail), file) == sizeof(tail);
+
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    index.clear();
+    return ok;
+}
+
+// Rebuilds the index of a file that was never closed from the block headers. Stops at
+// the first block that is cut short or out of order and drops the chunk it belongs to,
+// so every channel comes back with the same rows.
+static bool
+scan_blocks(FILE* f, uint64_t size, std::vector<imu_export::chunk_info>* out)
+{
+    uint8_t hdr[BLOCK_HEADER_SIZE];
+    if (seek64(f, 0, SEEK_SET) != 0 || fread(hdr, 1, HEADER_SIZE, f) != (size_t)HEADER_SIZE || memcmp(hdr, MAGIC, sizeof(MAGIC)) != 0 ||
+        get_le(&hdr[8], 4) != imu_export::CHANNEL_COUNT) {
+        return false; // not an export, or one from before block headers
+    }
+
+    uint64_t pos = HEADER_SIZE;
+    while (pos + BLOCK_HEADER_SIZE <= size) {
+        if (seek64(f, pos, SEEK_SET) != 0 || fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, BLOCK_MAGIC, sizeof(BLOCK_MAGIC)) != 0) break;
+
+        imu_export::chunk_info info;
+        info.channel = (uint32_t)get_le(&hdr[4], 4);
+        info.samples = (uint32_t)get_le(&hdr[8], 4);
+        info.offset = pos + BLOCK_HEADER_SIZE;
+        info.stored_size = (uint32_t)get_le(&hdr[12], 4);
+        info.raw_size = (uint32_t)get_le(&hdr[16], 4);
+        info.first_ts = get_le(&hdr[20], 8);
+        info.last_ts = get_le(&hdr[28], 8);
+        if (info.channel != out->size() % imu_export::CHANNEL_COUNT || info.offset + info.stored_size > size) break;
+
+        out->push_back(info);
+        pos = info.offset + info.stored_size;
+    }
+
+    out->resize(out->size() - out->size() % imu_export::CHANNEL_COUNT);
+    return true;
+}
+
+bool
+imu_export::read_index(const std::string& path, std::vector<chunk_info>* out)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) return false;
+
+    out->clear();
+
+    uint8_t tail[TAIL_SIZE];
+    seek64(f, 0, SEEK_END);
+    uint64_t size = tell64(f);
+    if (size < (uint64_t)(HEADER_SIZE + TAIL_SIZE) || seek64(f, size - TAIL_SIZE, SEEK_SET) != 0 ||
+        fread(tail, 1, sizeof(tail), f) != sizeof(tail) || memcmp(&tail[16], TAIL_MAGIC, sizeof(TAIL_MAGIC)) != 0) {
+        bool ok = scan_blocks(f, size, out); // not closed cleanly, or not an export
+        fclose(f);
+        return ok;
+    }
+
+    uint64_t index_offset = get_le(&tail[0], 8);
+    uint32_t count = (uint32_t)get_le(&tail[8], 4);
+    if (index_offset + (uint64_t)count * INDEX_ENTRY_SIZE + TAIL_SIZE != size) {
+        bool ok = scan_blocks(f, size, out);
+        fclose(f);
+        return ok;
+    }
+
+    std::vector<uint8_t> raw((size_t)count * INDEX_ENTRY_SIZE);
+    seek64(f, index_offset, SEEK_SET);
+    bool ok = fread(raw.data(), 1, raw.size(), f) == raw.size();
+    fclose(f);
+    if (!ok) return false;
+
+    out->resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* e = &raw[(size_t)i * INDEX_ENTRY_SIZE];
+        chunk_info& info = (*out)[i];
+        info.channel = (uint32_t)get_le(&e[0], 4);
+        info.samples = (uint32_t)get_le(&e[4], 4);
+        info.offset = get_le(&e[8], 8);
+        info.stored_size = (uint32_t)get_le(&e[16], 4);
+        info.raw_size = (uint32_t)get_le(&e[20], 4);
+        info.first_ts = get_le(&e[24], 8);
+        info.last_ts = get_le(&e[32], 8);
+    }
+    return true;
+}
+
+// appends the decoded, unshuffled bytes of every block of one channel to out
+static bool
+read_blocks(const std::string& path, int channel, size_t width, std::vector<uint8_t>* out)
+{
+    std::vector<imu_export::chunk_info> index;
+    if (!imu_export::read_index(path, &index)) return false;
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f == nullptr) return false;
+
+    std::vector<uint8_t> stored, raw;
+    bool ok = true;
+
+    for (const imu_export::chunk_info& info : index) {
+        if ((int)info.channel != channel) continue;
+        if (info.raw_size != info.samples * width) {
+            ok = false;
+            break;
+        }
+
+        stored.resize(info.stored_size);
+        if (seek64(f, info.offset, SEEK_SET) != 0 || fread(stored.data(), 1, stored.size(), f) != stored.size()) {
+            ok = false;
+            break;
+        }
+
+        raw.resize(info.raw_size);
+        if (info.stored_size == info.raw_size) {
+            raw = stored;
+        }
+        else {
+            uLongf raw_size = info.raw_size;
+            if (uncompress(raw.data(), &raw_size, stored.data(), info.stored_size) != Z_OK || raw_size != info.raw_size) {
+                ok = false;
+                break;
+            }
+        }
+
+        size_t base = out->size();
+        out->resize(base + raw.size());
+        unshuffle(raw.data(), out->data() + base, info.samples, width);
+    }
+
+    fclose(f);
+    return ok;
+}
+
+bool
+imu_export::read_timestamps(const std::string& path, std::vector<uint64_t>* out)
+{
+    std::vector<uint8_t> bytes;
+    if (!read_blocks(path, CH_TIMESTAMP, 8, &bytes)) return false;
+
+    std::vector<chunk_info> index;
+    read_index(path, &index);
+
+    out->resize(bytes.size() / 8);
+    size_t row = 0;
+    for (const chunk_info& info : index) {
+        if (info.channel != CH_TIMESTAMP) continue;
+        uint64_t prev = 0;
+        for (uint32_t i = 0; i < info.samples; i++, row++) {
+            prev += get_le(&bytes[row * 8], 8);
+            (*out)[row] = prev;
+        }
+    }
+    return true;
+}
+
+bool
+imu_export::read_channel(const std::string& path, int channel, std::vector<float>* out)
+{
+    if (channel <= CH_TIMESTAMP || channel >= CHANNEL_COUNT) return false;
+
+    std::vector<uint8_t> bytes;
+    if (!read_blocks(path, channel, sizeof(float), &bytes)) return false;
+
+    out->resize(bytes.size() / sizeof(float));
+    if (!bytes.empty()) memcpy(out->data(), bytes.data(), bytes.size());
+    return true;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "imu.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Columnar IMU session file. Samples are buffered per channel and every chunk_samples
+// rows each channel is written as one contiguous, zlib compressed block (timestamps
+// delta coded, floats byte shuffled). A footer index of every block lets a reader
+// pull a single channel without touching the others. Each block also carries its own
+// header, so a file cut short before the footer (a crash, a full disk) is still read by
+// walking the blocks; a trailing chunk that lost any of its channels is left out.
+//
+// There are two chunk buffers: add() fills one while a writer thread compresses and
+// writes the other, so the IMU reader only copies the sample. add() blocks only when
+// the writer is still busy with the previous chunk as the next one fills.
+//
+//   header  "RUIMU\2\0\0", u32 channel_count, u32 chunk_samples
+//   blocks  "RUIB", u32 channel, u32 samples, u32 stored_size, u32 raw_size, u64 first_ts,
+//           u64 last_ts, then stored_size bytes; chunk by chunk, channels in order
+//   index   chunk_info[entry_count], 40 bytes each, offsets point past the block header
+//   tail    u64 index_offset, u32 entry_count, u32 reserved, "RUIMUEND"
+class imu_export
+{
+public:
+    enum channel_t {
+        CH_TIMESTAMP = 0,    // u64 ns, every other channel is f32
+        CH_GYRO_X, CH_GYRO_Y, CH_GYRO_Z,
+        CH_ACCEL_X, CH_ACCEL_Y, CH_ACCEL_Z,
+        CH_MAG_X, CH_MAG_Y, CH_MAG_Z,
+        CH_TEMPERATURE,
+        CHANNEL_COUNT
+    };
+
+    typedef struct {
+        uint32_t channel;
+        uint32_t samples;
+        uint64_t offset;
+        uint32_t stored_size;    // == raw_size when the block did not compress
+        uint32_t raw_size;
+        uint64_t first_ts;
+        uint64_t last_ts;
+    } chunk_info;
+
+    imu_export();
+    ~imu_export();
+
+    bool open(const std::string& path, uint32_t chunk_samples = 4096);
+    bool add(const imu::sample& s);
+    bool close();
+    uint64_t samples_written() const { return total_samples; }
+
+    static const char* channel_name(int channel);
+    // from the footer, or from the block headers when there is none
+    static bool read_index(const std::string& path, std::vector<chunk_info>* index);
+    static bool read_timestamps(const std::string& path, std::vector<uint64_t>* out);
+    static bool read_channel(const std::string& path, int channel, std::vector<float>* out);
+
+private:
+    typedef struct {
+        uint32_t rows;
+        std::vector<uint64_t> timestamps;
+        std::vector<float> columns[CHANNEL_COUNT];
+    } chunk;
+
+    // reader side, queues the filling chunk for the writer and switches to the other one
+    bool hand_off();
+    // writer thread
+    void write_chunks();
+    bool flush_chunk(const chunk& c);
+    bool write_block(int channel, const uint8_t* raw, uint32_t raw_size, uint32_t samples, uint64_t first_ts, uint64_t last_ts);
+
+    FILE* file;
+    uint32_t chunk_samples;
+    uint64_t total_samples;
+    chunk chunks[2];
+    int filling;
+
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable cv;
+    chunk* queued;               // handed to the writer and not written yet
+    bool stopping;
+    std::atomic<bool> failed;
+
+    // writer thread only
+    uint64_t offset;
+    std::vector<uint8_t> raw_buf;
+    std::vector<uint8_t> shuffle_buf;
+    std::vector<uint8_t> zip_buf;
+    std::vector<chunk_info> index;
+};
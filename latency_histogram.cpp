@@ -0,0 +1,84 @@
+#include "latency_histogram.h"
+
+latency_histogram::latency_histogram()
+{
+    reset();
+}
+
+int
+latency_histogram::bucket_for(uint64_t ns)
+{
+    if (ns < SUB_BUCKETS) return (int)ns;
+
+    int msb = 63;
+    while (!(ns >> msb)) msb--;
+
+    // msb >= 3 here; the three bits below the msb pick the sub bucket
+    int sub = (int)((ns >> (msb - 3)) & (SUB_BUCKETS - 1));
+    return (msb - 2) * SUB_BUCKETS + sub;
+}
+
+uint64_t
+latency_histogram::bucket_upper(int bucket)
+{
+    if (bucket < SUB_BUCKETS) return (uint64_t)bucket;
+
+    int msb = bucket / SUB_BUCKETS + 2;
+    uint64_t sub = bucket % SUB_BUCKETS;
+    uint64_t base = ((uint64_t)SUB_BUCKETS + sub) << (msb - 3);
+    return base + ((uint64_t)1 << (msb - 3)) - 1;
+}
+
+void
+latency_histogram::record(uint64_t ns)
+{
+    buckets[bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t prev = maximum.load(std::memory_order_relaxed);
+    while (ns > prev && !maximum.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void
+latency_histogram::reset()
+{
+    for (int i = 0; i < BUCKETS; i++)
+        buckets[i].store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    maximum.store(0, std::memory_order_relaxed);
+}
+
+uint64_t
+latency_histogram::mean() const
+{
+    uint64_t n = count();
+    return n == 0 ? 0 : sum.load(std::memory_order_relaxed) / n;
+}
+
+uint64_t
+latency_histogram::percentile(double p) const
+{
+    // sum the buckets rather than trusting total, they are updated independently
+    uint64_t n = 0;
+    for (int i = 0; i < BUCKETS; i++)
+        n += buckets[i].load(std::memory_order_relaxed);
+    if (n == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)n + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            uint64_t m = max();
+            return upper < m ? upper : m;
+        }
+    }
+    return max();
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+
+// Lock-free log-linear histogram of durations in ns: 8 buckets per power of two, so
+// every reported percentile is within 12.5% of the true value. record() is a couple
+// of relaxed atomic adds and can be called from any thread.
+class latency_histogram
+{
+public:
+    static const int SUB_BUCKETS = 8;
+    static const int BUCKETS = 64 * SUB_BUCKETS;
+
+    latency_histogram();
+
+    void record(uint64_t ns);
+    void reset();
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+    uint64_t mean() const;
+    // p in [0, 100], returns the upper bound of the bucket holding that percentile
+    uint64_t percentile(double p) const;
+
+private:
+    static int bucket_for(uint64_t ns);
+    static uint64_t bucket_upper(int bucket);
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> maximum;
+};
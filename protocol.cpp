@@ -8,7 +8,6 @@
 #include <stdint.h>
 #include <string>
 #include <zlib.h>
-#include <intrin.h>
 
 const uint8_t HEAD = 0xfd;
 const int MSG_ID_OFS = 15;
@@ -19,90 +18,44 @@ const int CRC_OFS = 1;
 const int TS_OFS = 7;
 const int RESERVED_OFS = 17;
 
+const bool PRINT_TEXT = true;
+const bool PRINT_BYTES = false;
+
 static const std::map<std::string, uint16_t> MESSAGES = {
-    {"W_CANCEL_ACTIVATION", 0x19},
-    {"R_MCU_APP_FW_VERSION", 0x26},//MCU APP FW version.
-    {"R_GLASSID" , 0x15},//GLASS HW ID.
-    {"R_DSP_APP_FW_VERSION", 0x21},//DSP APP FW version.
-    {"R_DP7911_FW_VERSION" , 0x16},//DP APP FW version.
-    {"R_ACTIVATION_TIME" , 0x29},//Read activation time
-    {"W_ACTIVATION_TIME" , 0x2A},//Write activation time
-    {"W_SLEEP_TIME" , 0x1E},//Write unsleep time
-    {"R_IS_NEED_UPGRADE_DSP_FW", 0x49},//Check whether the DSP needs to be upgraded.
-    {"W_FORCE_UPGRADE_DSP_FW", 0x69},//Force upgrade DSP.
-    {"R_DSP_VERSION", 0x18}, //DSP APP FW version.
-    {"W_UPDATE_DSP_APP_FW_PREPARE" , 0x45},	//(Implemented in APP)
-    {"W_UPDATE_DSP_APP_FW_START" , 0x46},	//(Implemented in APP)
-    {"W_UPDATE_DSP_APP_FW_TRANSMIT" , 0x47},	//(Implemented in APP)
-    {"E_DSP_ONE_PACKGE_WRITE_FINISH" , 0x6C0E},	//(check 4K as one package send)
-    {"W_UPDATE_DSP_APP_FW_FINISH" , 0x48},	//(Implemented in APP)
-    {"E_DSP_UPDATE_ENDING" , 0x6C11}, //whether the upgrade is complete.
-    {"E_DSP_UPDATE_PROGRES" , 0x6C10}, //before upgrade dsp, air for update dsp boot
-
-    {"W_UPDATE_MCU_APP_FW_PREPARE" , 0x3E},//Preparations for mcu app fw upgrade
-    {"W_UPDATE_MCU_APP_FW_START" , 0x3F},	//(Implemented in Boot)
-    {"W_UPDATE_MCU_APP_FW_TRANSMIT" , 0x40},	//(Implemented in Boot)
-    {"W_UPDATE_MCU_APP_FW_FINISH" , 0x41},	//(Implemented in Boot)
-    {"W_BOOT_JUMP_TO_APP" , 0x42},	//(Implemented in Boot)
-    {"W_MCU_APP_JUMP_TO_BOOT" , 0x44},
-    {"R_DP7911_FW_IS_UPDATE" , 0x3C},
-    {"W_UPDATE_DP" , 0x3D},
-
-
-    {"W_BOOT_UPDATE_MODE" , 0x1100},
-    {"W_BOOT_UPDATE_CONFIRM" , 0x1101},
-    {"W_BOOT_UPDATE_PREPARE" , 0x1102},
-
-    {"W_BOOT_UPDATE_START" , 0x1103},
-    {"W_BOOT_UPDATE_TRANSMIT" , 0x1104},
-    {"W_BOOT_UPDATE_FINISH" , 0x1105},
-
-    // P_ = pushed from device
-
-    // 11-bit payload
-    {"P_BUTTON_PRESSED", 0x6C05},
-
-    // appear to fire every 5 seconds with payload = 0
-    {"P_UKNOWN_HEARTBEAT" , 0x6c02},
-    {"P_UKNOWN_HEARTBEAT_2" , 0x6c12},
-
-    {"W_DISP_MODE", 0x08},
-    {"ASYNC_TEXT_LOG", 0x6c09},
-    {"HEARTBEAT", 0x1A}
+#define CONTROL_MSG(name, id, print) { #name, id },
+#include "protocol_schema.inc"
 };
 
-std::string
-protocol::keyForHex(uint16_t hex) {
-    std::string value;
-        
-    std::map<std::string, uint16_t>::const_iterator it;
-
-    for (it = MESSAGES.begin(); it != MESSAGES.end(); it++)
-    {
-        if (it->second == hex) {
-            value = it->first;
-            return value;
-        }
+const char*
+protocol::name(uint16_t msgId)
+{
+    switch (msgId) {
+#define CONTROL_MSG(name, id, print) case id: return #name;
+#include "protocol_schema.inc"
+    default: return nullptr;
     }
-    value = "UNKNOWN_COMMAND";
-    return value; 
 }
 
-uint16_t
-protocol::hexForKey(std::string key) {
-    uint16_t hex_id;
+bool
+protocol::is_text(uint16_t msgId)
+{
+    switch (msgId) {
+#define CONTROL_MSG(name, id, print) case id: return PRINT_##print;
+#include "protocol_schema.inc"
+    default: return false;
+    }
+}
 
-    std::map<std::string, uint16_t>::const_iterator it;
+const char*
+protocol::keyForHex(uint16_t hex) {
+    const char* value = name(hex);
+    return value != nullptr ? value : "UNKNOWN_COMMAND";
+}
 
-    for (it = MESSAGES.begin(); it != MESSAGES.end(); it++)
-    {
-        if (key.compare(it->first)==0) {
-            hex_id = it->second;
-            return hex_id;
-        }
-    }
-    hex_id = 0x0000;
-    return hex_id;
+uint16_t
+protocol::hexForKey(const std::string& key) {
+    std::map<std::string, uint16_t>::const_iterator it = MESSAGES.find(key);
+    return it != MESSAGES.end() ? it->second : 0;
 }
 
 void
@@ -122,7 +75,7 @@ protocol::listKnownCommands() {
 }
 
 int 
-protocol::cmd_build(std::string msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size) {
+protocol::cmd_build(const std::string& msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size) {
     uint16_t hex_msg_id = hexForKey(msg_id);
 
     return cmd_build(hex_msg_id, p_buf, p_size, cmd_buf, cb_size);
@@ -131,12 +84,14 @@ protocol::cmd_build(std::string msg_id, const uint8_t* p_buf, int p_size, uint8_
 int
 protocol::cmd_build(uint16_t msgId, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size) {
 
-    uint16_t len = /*HEAD*/1+ /*CRC*/4 + /*LEN*/2 + /*TS*/8 + /*MSG_ID*/2 + /*RESERVED*/5;
+    int len = /*HEAD*/1+ /*CRC*/4 + /*LEN*/2 + /*TS*/8 + /*MSG_ID*/2 + /*RESERVED*/5;
+
+    if (cmd_buf == nullptr || cb_size < len) return 0;
 
     if (p_buf != nullptr && p_size > 0) {
         len += p_size;
 
-        if (cb_size < len) return 0; // check if cmd will fit in buffer
+        if (cb_size < len || len - 5 > 0xffff) return 0; // check if cmd will fit in buffer and in the length field
 
         std::copy(p_buf, p_buf + p_size, &cmd_buf[PAYLOAD_OFS]);
     }
@@ -172,6 +127,7 @@ get_msgId(const uint8_t* buffer_in, int size) {
     if (size > MSG_ID_OFS+1) {
         return (buffer_in[MSG_ID_OFS] | (buffer_in[MSG_ID_OFS + 1] << 8));
     }
+    return protocol::INVALID_MSG_ID;
 }
 
 
@@ -180,6 +136,7 @@ get_status_byte(const uint8_t* buffer_in, int size) {
     if (size > STATUS_OFS) {
         return buffer_in[STATUS_OFS];
     }
+    return 0;
 }
 
 static uint16_t
@@ -187,6 +144,15 @@ get_length(const uint8_t* buffer_in, int size) {
     if (size > LEN_OFS +1) {
         return (buffer_in[LEN_OFS] | (buffer_in[LEN_OFS + 1] << 8));
     }
+    return 0;
+}
+
+static uint32_t
+get_crc(const uint8_t* buffer_in, int size) {
+    if (size > CRC_OFS + 3) {
+        return ((uint32_t)buffer_in[CRC_OFS] | ((uint32_t)buffer_in[CRC_OFS + 1] << 8) | ((uint32_t)buffer_in[CRC_OFS + 2] << 16) | ((uint32_t)buffer_in[CRC_OFS + 3] << 24));
+    }
+    return 0;
 }
 
 static void
@@ -207,30 +173,22 @@ void
 protocol::print_summary_rsp(parsed_rsp* result)
 {
     std::cout << "msgId: 0x" << std::setfill('0') << std::setw(4) << std::right << std::hex << (int)result->msgId << ", ";
-    if (result->msgId != -1)
+    if (result->msgId != INVALID_MSG_ID)
     {
         std::cout << "msgId decode: " << keyForHex(result->msgId) << ", ";
     }
     std::cout << "status: 0x" << std::setfill('0') << std::setw(2) << std::right << std::hex << (int)result->status << ", ";
     std::cout << "payload_size: 0x" << result->payload_size << ", ";
+    if (!result->valid)
+    {
+        std::cout << "INVALID, ";
+    }
 
     
     std::cout << "payload: ";
 
-    switch (result->msgId) {
-    case 0x6c09: // ASYNC TEXT LOG
-    case 0x0015: // GLASS HW ID.
-    case 0x0026: // MCU APP FW version.
-    case 0x0021: // DSP APP FW version.
-    case 0x0016: // DP APP FW version.
-    case 0x0018: // DSP version.
-        print_chars(result->payload, result->payload_size);
-        //std::cout << std::endl;
-        break;
-    default:
-        print_bytes(result->payload, result->payload_size);
-        break;
-    }
+    if (is_text(result->msgId)) print_chars(result->payload, result->payload_size);
+    else print_bytes(result->payload, result->payload_size);
 
     std::cout << " " << std::endl;
 }
@@ -238,8 +196,9 @@ protocol::print_summary_rsp(parsed_rsp* result)
 void
 protocol::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
     //initialize result struct
-    result->msgId = -1;
+    result->msgId = INVALID_MSG_ID;
     result->status = 0;
+    result->valid = false;
     result->payload_size = 0;
     std::fill(result->payload, result->payload + sizeof(result->payload), 0);
 
@@ -248,7 +207,10 @@ protocol::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
     }
     
     if (buffer_in[0] != HEAD) {
-        std::cout << "HEAD mismatch " << std::hex << buffer_in[0] << std::endl;
+#ifndef REAL_UTILITIES_C_EXPORTS
+        // the C library never writes to its host's stdout
+        std::cout << "HEAD mismatch " << std::hex << (int)buffer_in[0] << std::endl;
+#endif
         return;
     }
 
@@ -257,12 +219,17 @@ protocol::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
 
     int packet_len = get_length(buffer_in, size);
     
-    if (packet_len < 18) {
+    // never trust the length field past the bytes actually received
+    if (packet_len < (PAYLOAD_OFS - LEN_OFS) || LEN_OFS + packet_len > size) {
         return;
     }
     result->payload_size = packet_len - (PAYLOAD_OFS - LEN_OFS); // ;/* len, ts, msgid, reserve, status*/
     
-    if (result->payload_size <= sizeof(result->payload))
+    if (result->payload_size > sizeof(result->payload))
+    {
+        result->payload_size = sizeof(result->payload);
+    }
+
     {
         std::copy(&buffer_in[PAYLOAD_OFS], &buffer_in[PAYLOAD_OFS] + result->payload_size, result->payload);
 
@@ -280,6 +247,8 @@ protocol::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
 
     std::cout << "CRC: " << std::hex << crc << std::endl;*/
 
+    result->valid = (crc == get_crc(buffer_in, size));
+
     return;
 };
 //
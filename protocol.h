@@ -1,22 +1,38 @@
 #pragma once
+#include <stdint.h>
 #include <string>
 
 class protocol
 {
     public:
+        static const uint16_t INVALID_MSG_ID = 0xffff;
+        // the device pushes P_UKNOWN_HEARTBEAT this often
+        static const uint64_t HEARTBEAT_PERIOD_NS = 5000000000ull;
+
+        // message ids from protocol_schema.inc, protocol::W_DISP_MODE etc.
+        enum msg_t : uint16_t {
+#define CONTROL_MSG(name, id, print) name = id,
+#include "protocol_schema.inc"
+        };
+
         typedef struct {
             uint16_t msgId;
             uint8_t status;
             uint8_t payload[200];
             uint16_t payload_size;
+            bool valid;             // head, length and CRC all check out
         } parsed_rsp;
 
         static void listKnownCommands();
-        static std::string keyForHex(uint16_t hex);
-        static uint16_t hexForKey(std::string key);
+        static const char* keyForHex(uint16_t hex);
+        // nullptr for an unknown id
+        static const char* name(uint16_t msgId);
+        // payload is printable text rather than bytes
+        static bool is_text(uint16_t msgId);
+        static uint16_t hexForKey(const std::string& key);
         static void parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result);
         static int cmd_build(uint16_t msgId, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size);
-        static int cmd_build(std::string msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size);
+        static int cmd_build(const std::string& msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size);
         static void print_summary_rsp(parsed_rsp* result);
 };
 
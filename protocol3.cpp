@@ -8,7 +8,6 @@
 #include <stdint.h>
 #include <string>
 #include <zlib.h>
-#include <intrin.h>
 
 const uint8_t HEAD = 0xaa;
 const int MSG_ID_OFS = 7;
@@ -18,50 +17,45 @@ const int CRC_OFS = 1;
 const int NO_PAYLOAD_PACKET_LEN = 3;
 
 
+const bool PRINT_TEXT = true;
+const bool PRINT_BYTES = false;
+
 static const std::map<std::string, uint8_t> MESSAGES = {
-    {"GET_CAL_DATA_LENGTH", 0x14},
-    {"CAL_DATA_GET_NEXT_SEGMENT", 0x15},
-    {"ALLOCATE_CAL_DATA_BUFFER" , 0x16},
-    {"WRITE_CAL_DATA_SEGMENT", 0x17},
-    {"FREE_CAL_BUFFER" , 0x18},
-    {"START_IMU_DATA" , 0x19}, // start glasses if data is 0x01 ? ? ?
-    {"GET_STATIC_ID" , 0x1a}, // return static data 0x01012220
-    {"UNKNOWN_1D" , 0x1d}
+#define IMU_MSG(name, id, print) { #name, id },
+#include "protocol_schema.inc"
 };
 
 
-std::string
-protocol3::keyForHex(uint8_t hex) {
-    std::string value;
-
-    std::map<std::string, uint8_t>::const_iterator it;
-
-    for (it = MESSAGES.begin(); it != MESSAGES.end(); it++)
-    {
-        if (it->second == hex) {
-            value = it->first;
-            return value;
-        }
+const char*
+protocol3::name(uint8_t msgId)
+{
+    switch (msgId) {
+#define IMU_MSG(name, id, print) case id: return #name;
+#include "protocol_schema.inc"
+    default: return nullptr;
     }
-    value = "UNKNOWN_COMMAND";
-    return value;
 }
 
-uint8_t
-protocol3::hexForKey(std::string key) {
-    uint8_t hex_id;
+bool
+protocol3::is_text(uint8_t msgId)
+{
+    switch (msgId) {
+#define IMU_MSG(name, id, print) case id: return PRINT_##print;
+#include "protocol_schema.inc"
+    default: return false;
+    }
+}
 
-    std::map<std::string, uint8_t>::const_iterator it;
+const char*
+protocol3::keyForHex(uint8_t hex) {
+    const char* value = name(hex);
+    return value != nullptr ? value : "UNKNOWN_COMMAND";
+}
 
-    for (it = MESSAGES.begin(); it != MESSAGES.end(); it++)
-    {
-        if (key.compare(it->first) == 0) {
-            hex_id = it->second;
-            return hex_id;
-        }
-    }
-    hex_id = 0x00;
-    return hex_id;
+uint8_t
+protocol3::hexForKey(const std::string& key) {
+    std::map<std::string, uint8_t>::const_iterator it = MESSAGES.find(key);
+    return it != MESSAGES.end() ? it->second : 0;
 }
 
 void
@@ -75,14 +69,14 @@ protocol3::listKnownCommands() {
     {
         std::cout << it->first    // string (key)
             << ':'
-            << std::hex << it->second   // string's value 
+            << std::hex << (int)it->second   // string's value 
             << std::endl;
     }
 }
 
 
 int
-protocol3::cmd_build(std::string msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size) {
+protocol3::cmd_build(const std::string& msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size) {
     uint8_t hex_msg_id = hexForKey(msg_id);
 
     return cmd_build(hex_msg_id, p_buf, p_size, cmd_buf, cb_size);
@@ -91,12 +85,14 @@ protocol3::cmd_build(std::string msg_id, const uint8_t* p_buf, int p_size, uint8
 int
 protocol3::cmd_build(uint8_t msgId, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size) {
 
-    uint16_t len = /*HEAD*/1 + /*CRC*/4 + /*LEN*/2 + /*MSG_ID*/1; // 0x00 0xAA 4bytes_crc 2bytes_len 1byte_msgid 56bytes_data
+    int len = /*HEAD*/1 + /*CRC*/4 + /*LEN*/2 + /*MSG_ID*/1; // 0x00 0xAA 4bytes_crc 2bytes_len 1byte_msgid 56bytes_data
+
+    if (cmd_buf == nullptr || cb_size < len) return 0;
 
     if (p_buf != nullptr && p_size > 0) {
         len += p_size;
 
-        if (cb_size < len) return 0; // check if cmd will fit in buffer
+        if (cb_size < len || len - 5 > 0xffff) return 0; // check if cmd will fit in buffer and in the length field
 
         std::copy(p_buf, p_buf + p_size, &cmd_buf[PAYLOAD_OFS]);
     }
@@ -124,9 +120,10 @@ protocol3::cmd_build(uint8_t msgId, const uint8_t* p_buf, int p_size, uint8_t* c
 
 static uint8_t
 get_msgId(const uint8_t* buffer_in, int size) {
-    if (size >= MSG_ID_OFS) {
+    if (size > MSG_ID_OFS) {
         return buffer_in[MSG_ID_OFS];
     }
+    return protocol3::INVALID_MSG_ID;
 }
 
 static uint16_t
@@ -134,6 +131,15 @@ get_length(const uint8_t* buffer_in, int size) {
     if (size > LEN_OFS + 1) {
         return (buffer_in[LEN_OFS] | (buffer_in[LEN_OFS + 1] << 8));
     }
+    return 0;
+}
+
+static uint32_t
+get_crc(const uint8_t* buffer_in, int size) {
+    if (size > CRC_OFS + 3) {
+        return ((uint32_t)buffer_in[CRC_OFS] | ((uint32_t)buffer_in[CRC_OFS + 1] << 8) | ((uint32_t)buffer_in[CRC_OFS + 2] << 16) | ((uint32_t)buffer_in[CRC_OFS + 3] << 24));
+    }
+    return 0;
 }
 
 static void
@@ -154,24 +160,21 @@ void
 protocol3::print_summary_rsp(parsed_rsp* result)
 {
     std::cout << "msgId: 0x" << std::setfill('0') << std::setw(2) << std::right << std::hex << (int)result->msgId << ", ";
-    if (result->msgId != -1)
+    if (result->msgId != INVALID_MSG_ID)
     {
         std::cout << "msgId decode: " << keyForHex(result->msgId) << ", ";
     }
    std::cout << "payload_size: 0x" << result->payload_size << ", ";
+    if (!result->valid)
+    {
+        std::cout << "INVALID, ";
+    }
 
 
     std::cout << "payload: ";
 
-    switch (result->msgId) {
-    case 0x15: // CAL_DATA
-        print_chars(result->payload, result->payload_size);
-        //std::cout << std::endl;
-        break;
-    default:
-        print_bytes(result->payload, result->payload_size);
-        break;
-    }
+    if (is_text(result->msgId)) print_chars(result->payload, result->payload_size);
+    else print_bytes(result->payload, result->payload_size);
 
     std::cout << " " << std::endl;
 }
@@ -179,8 +182,9 @@ protocol3::print_summary_rsp(parsed_rsp* result)
 void
 protocol3::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
     //initialize result struct
-    result->msgId = -1;
+    result->msgId = INVALID_MSG_ID;
     result->payload_size = 0;
+    result->valid = false;
     std::fill(result->payload, result->payload + sizeof(result->payload), 0);
 
     if (buffer_in == NULL || size < 1) {
@@ -188,7 +192,10 @@ protocol3::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
     }
 
     if (buffer_in[0] != HEAD) {
-        std::cout << "HEAD mismatch " << std::hex << buffer_in[0] << std::endl;
+#ifndef REAL_UTILITIES_C_EXPORTS
+        // the C library never writes to its host's stdout
+        std::cout << "HEAD mismatch " << std::hex << (int)buffer_in[0] << std::endl;
+#endif
         return;
     }
 
@@ -196,12 +203,17 @@ protocol3::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
 
     int packet_len = get_length(buffer_in, size);
 
-    if (packet_len < NO_PAYLOAD_PACKET_LEN) {
+    // never trust the length field past the bytes actually received
+    if (packet_len < NO_PAYLOAD_PACKET_LEN || LEN_OFS + packet_len > size) {
         return;
     }
     result->payload_size = packet_len - (PAYLOAD_OFS - LEN_OFS); // ;/* len, ts, msgid, reserve, status*/
 
-    if (result->payload_size <= sizeof(result->payload))
+    if (result->payload_size > sizeof(result->payload))
+    {
+        result->payload_size = sizeof(result->payload);
+    }
+
     {
         std::copy(&buffer_in[PAYLOAD_OFS], &buffer_in[PAYLOAD_OFS] + result->payload_size, result->payload);
 
@@ -219,5 +231,7 @@ protocol3::parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result) {
 
     std::cout << "CRC: " << std::hex << crc << std::endl;*/
 
+    result->valid = (crc == get_crc(buffer_in, size));
+
     return;
-};
\ No newline at end of file
+};
\ No newline at end of file
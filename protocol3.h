@@ -1,21 +1,35 @@
 #pragma once
+#include <stdint.h>
 #include <string>
 
 class protocol3
 {
 public:
+    static const uint8_t INVALID_MSG_ID = 0xff;
+
+    // message ids from protocol_schema.inc, protocol3::START_IMU_DATA etc.
+    enum msg_t : uint8_t {
+#define IMU_MSG(name, id, print) name = id,
+#include "protocol_schema.inc"
+    };
+
     typedef struct {
         uint8_t msgId;
         uint8_t payload[200];
         uint16_t payload_size;
+        bool valid;             // head, length and CRC all check out
     } parsed_rsp;
 
     static void listKnownCommands();
-    static std::string keyForHex(uint8_t hex);
-    static uint8_t hexForKey(std::string key);
+    static const char* keyForHex(uint8_t hex);
+    // nullptr for an unknown id
+    static const char* name(uint8_t msgId);
+    // payload is printable text rather than bytes
+    static bool is_text(uint8_t msgId);
+    static uint8_t hexForKey(const std::string& key);
     static void parse_rsp(const uint8_t* buffer_in, int size, parsed_rsp* result);
     static int cmd_build(uint8_t msgId, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size);
-    static int cmd_build(std::string msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size);
+    static int cmd_build(const std::string& msg_id, const uint8_t* p_buf, int p_size, uint8_t* cmd_buf, int cb_size);
     static void print_summary_rsp(parsed_rsp* result);
 };
 
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+
+// Typed payloads generated from protocol_schema.inc. decode() and encode() are constexpr,
+// read and write fixed offsets and never allocate. decode() fails on a short payload and
+// encode() returns 0 when the buffer is too small, otherwise the payload size.
+class protocol_codec
+{
+public:
+    typedef uint8_t U8_t;
+    typedef uint16_t U16LE_t;
+    typedef uint32_t U32LE_t;
+
+#define PAYLOAD_BEGIN(type, size) struct type { static constexpr int SIZE = size;
+#define FIELD(type, name, kind, offset) kind##_t name = 0;
+#define PAYLOAD_END(type) };
+#include "protocol_schema.inc"
+
+#define PAYLOAD_BEGIN(type, size) \
+    static constexpr bool decode(const uint8_t* p_buf, int p_size, type* out) { \
+        if (p_size < size) return false;
+#define FIELD(type, name, kind, offset) out->name = get_##kind(p_buf + offset);
+#define PAYLOAD_END(type) return true; }
+#include "protocol_schema.inc"
+
+#define PAYLOAD_BEGIN(type, size) \
+    static constexpr int encode(const type& in, uint8_t* p_buf, int p_size) { \
+        if (p_size < size) return 0; \
+        for (int i = 0; i < size; i++) p_buf[i] = 0;
+#define FIELD(type, name, kind, offset) put_##kind(p_buf + offset, in.name);
+#define PAYLOAD_END(type) return type::SIZE; }
+#include "protocol_schema.inc"
+
+private:
+    static constexpr uint8_t get_U8(const uint8_t* b) { return b[0]; }
+    static constexpr uint16_t get_U16LE(const uint8_t* b) { return (uint16_t)(b[0] | b[1] << 8); }
+    static constexpr uint32_t get_U32LE(const uint8_t* b) { return (uint32_t)b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24; }
+
+    static constexpr void put_U8(uint8_t* b, uint8_t v) { b[0] = v; }
+    static constexpr void put_U16LE(uint8_t* b, uint16_t v) { b[0] = v & 0xff; b[1] = v >> 8; }
+    static constexpr void put_U32LE(uint8_t* b, uint32_t v) { b[0] = v & 0xff; b[1] = (v >> 8) & 0xff; b[2] = (v >> 16) & 0xff; b[3] = v >> 24; }
+};
@@ -9,15 +9,44 @@
 #include <Windows.h>
 #include <iostream>
 #include <iomanip>
+#include <csignal>
 #include <mutex>
 #include <chrono>
+#include <thread>
+#include <vector>
+#include <memory>
 #include "protocol.h"
 #include "protocol3.h"
+#include "protocol_codec.h"
+#include "device_log.h"
+#include "script.h"
+#include "imu.h"
+#include "imu_export.h"
+#include "imu_decimator.h"
+#include "display_mode.h"
+#include "event_bus.h"
+#include "rt_thread.h"
+#include "hid_transport.h"
+#include "async_device.h"
+#include "capture_transport.h"
+#include "replay_transport.h"
+#include "dashboard.h"
+#include "sim_device.h"
+#include "soak.h"
+#include "alloc_tracker.h"
 
 //Air USB VID and PID
 #define AIR_VID 0x3318
 #define AIR_PID 0x0424
 
+static device_log dev_log;
+
+// --quiet turns off the per packet Read/Write lines
+static bool print_packets = true;
+
+// --rt <reader|dispatcher|logger>:<spec>
+static rt_thread::config reader_rt, dispatcher_rt, logger_rt;
+
 static hid_device*
 open_device(int interface_num)
 {
@@ -57,19 +86,21 @@ print_chars(const uint8_t* buffer, int size)
 }
 
 static int
-write_control(hid_device* device_control, uint16_t msgId, const uint8_t* p_buf, int p_size)
+write_control(transport* device_control, uint16_t msgId, const uint8_t* p_buf, int p_size)
 {
 	uint8_t cmd_buf[1024];
 	std::fill(cmd_buf, cmd_buf + sizeof(cmd_buf), 0);
 
 	int cmd_len = protocol::cmd_build(msgId, p_buf, p_size, &cmd_buf[1], sizeof(cmd_buf)-1); // leaves first byte=0x00, hid_write requirement
 
-	int res_control = hid_write(device_control, cmd_buf, cmd_len + 1);
+	int res_control = device_control->write(cmd_buf, cmd_len + 1);
 	if (res_control < 0) {
 		printf("Unable to write to device\n");
 		return 1;
 	}
 
+	if (!print_packets) return 0;
+
 	protocol::parsed_rsp result;
 	//std::cout << "Write: ";
 	std::cout << "Write(" << res_control << " bytes): ";
@@ -81,7 +112,7 @@ write_control(hid_device* device_control, uint16_t msgId, const uint8_t* p_buf,
 }
 
 static int
-write_control(hid_device* device_control, std::string msg_id, const uint8_t* p_buf, int p_size)
+write_control(transport* device_control, const std::string& msg_id, const uint8_t* p_buf, int p_size)
 {
 	uint16_t hex_msg_id = protocol::hexForKey(msg_id);
 	
@@ -89,16 +120,16 @@ write_control(hid_device* device_control, std::string msg_id, const uint8_t* p_b
 }
 
 static int
-read_control(hid_device* device_control, int timeout_ms)
+read_control(transport* device_control, int timeout_ms)
 {
 	uint8_t read_buf[1024];
 	std::fill(read_buf, read_buf + sizeof(read_buf), 0);
 
-	int res;
+	int res = 0;
 
 	try {
 		// code that might throw an exception
-		res = hid_read(device_control, read_buf, sizeof(read_buf));
+		res = device_control->read(read_buf, sizeof(read_buf), -1);
 		if (res < 0) {
 			return res;
 		}
@@ -109,8 +140,15 @@ read_control(hid_device* device_control, int timeout_ms)
 	}
 	
 	protocol::parsed_rsp result;
-	std::cout << "Read(" << res << " bytes): ";
 	protocol::parse_rsp(read_buf, res, &result);
+
+	if (dev_log.is_open() && result.msgId == protocol::ASYNC_TEXT_LOG) {
+		dev_log.feed(result.payload, result.payload_size, device_log::now_ms());
+		return res;
+	}
+	if (!print_packets) return res;
+
+	std::cout << "Read(" << res << " bytes): ";
 	protocol::print_summary_rsp(&result);
 	//print_bytes(read_buf, res);
 
@@ -118,14 +156,30 @@ read_control(hid_device* device_control, int timeout_ms)
 }
 
 static int
-write_imu(hid_device* device_imu, uint8_t msgId, const uint8_t* p_buf, int p_size)
+read_control_get_rsp(transport* device_control, int timeout_ms, protocol::parsed_rsp* out)
+{
+	uint8_t read_buf[1024];
+	std::fill(read_buf, read_buf + sizeof(read_buf), 0);
+
+	int res = device_control->read(read_buf, sizeof(read_buf), timeout_ms);
+	if (res < 0) {
+		return res;
+	}
+
+	protocol::parse_rsp(read_buf, res, out);
+
+	return res;
+}
+
+static int
+write_imu(transport* device_imu, uint8_t msgId, const uint8_t* p_buf, int p_size)
 {
 	uint8_t cmd_buf[1024];
 	std::fill(cmd_buf, cmd_buf + sizeof(cmd_buf), 0);
 
 	int cmd_len = protocol3::cmd_build(msgId, p_buf, p_size, &cmd_buf[1], sizeof(cmd_buf) - 1); // leaves first byte=0x00, hid_write requirement
 
-	int res_control = hid_write(device_imu, cmd_buf, cmd_len + 1);
+	int res_control = device_imu->write(cmd_buf, cmd_len + 1);
 	if (res_control < 0) {
 		printf("Unable to write to device\n");
 		return 1;
@@ -142,7 +196,7 @@ write_imu(hid_device* device_imu, uint8_t msgId, const uint8_t* p_buf, int p_siz
 }
 
 static int
-write_imu(hid_device* device_imu, std::string msg_id, const uint8_t* p_buf, int p_size)
+write_imu(transport* device_imu, const std::string& msg_id, const uint8_t* p_buf, int p_size)
 {
 	uint8_t hex_msg_id = protocol3::hexForKey(msg_id);
 
@@ -150,16 +204,27 @@ write_imu(hid_device* device_imu, std::string msg_id, const uint8_t* p_buf, int
 }
 
 static int
-read_imu(hid_device* device_imu, int timeout_ms)
+write_imu_stream(transport* device_imu, bool enable)
+{
+	protocol_codec::imu_stream_request request;
+	request.enable = enable ? 1 : 0;
+
+	uint8_t p_buf[protocol_codec::imu_stream_request::SIZE];
+	int p_size = protocol_codec::encode(request, p_buf, sizeof(p_buf));
+	return write_imu(device_imu, protocol3::START_IMU_DATA, p_buf, p_size);
+}
+
+static int
+read_imu(transport* device_imu, int timeout_ms)
 {
 	uint8_t read_buf[1024];
 	std::fill(read_buf, read_buf + sizeof(read_buf), 0);
 
-	int res;
+	int res = 0;
 
 	try {
 		// code that might throw an exception
-		res = hid_read(device_imu, read_buf, sizeof(read_buf));
+		res = device_imu->read(read_buf, sizeof(read_buf), -1);
 		if (res < 0) {
 			return res;
 		}
@@ -169,6 +234,8 @@ read_imu(hid_device* device_imu, int timeout_ms)
 		std::cerr << e.what();
 	}
 
+	if (!print_packets) return res;
+
 	protocol3::parsed_rsp result;
 	std::cout << "Read(" << res << " bytes): ";
 	protocol3::parse_rsp(read_buf, res, &result);
@@ -179,16 +246,16 @@ read_imu(hid_device* device_imu, int timeout_ms)
 }
 
 static int
-read_imu_get_rsp(hid_device* device_imu, int timeout_ms, protocol3::parsed_rsp* out)
+read_imu_get_rsp(transport* device_imu, int timeout_ms, protocol3::parsed_rsp* out)
 {
 	uint8_t read_buf[1024];
 	std::fill(read_buf, read_buf + sizeof(read_buf), 0);
 
-	int res;
+	int res = 0;
 
 	try {
 		// code that might throw an exception
-		res = hid_read(device_imu, read_buf, sizeof(read_buf));
+		res = device_imu->read(read_buf, sizeof(read_buf), -1);
 		if (res < 0) {
 			return res;
 		}
@@ -206,64 +273,941 @@ read_imu_get_rsp(hid_device* device_imu, int timeout_ms, protocol3::parsed_rsp*
 	return res;
 }
 
-int main()
+static void
+print_log_entry(const device_log::entry& e, void* ctx)
 {
+	int* count = static_cast<int*>(ctx);
+	(*count)++;
+	std::cout << std::dec << e.host_time_ms << " " << e.device_time << " " << device_log::level_name(e.level) << " " << (e.module.empty() ? "-" : e.module) << ": " << e.message << std::endl;
+}
 
-	hid_device* device_imu;
-	hid_device* device_control;
-
-	uint8_t cmd_buf[64];
+// --query-log <base> <minutes> [module] [level]
+static int
+query_log(int argc, char* argv[])
+{
+	if (argc < 4) {
+		printf("usage: --query-log <base> <minutes> [module] [level]\n");
+		return 1;
+	}
 
+	device_log::query_t q;
+	q.to_ms = device_log::now_ms();
+	q.from_ms = q.to_ms - strtoull(argv[3], nullptr, 10) * 60 * 1000;
+	q.module = argc > 4 ? argv[4] : "";
+	q.min_level = argc > 5 ? device_log::level_for_name(argv[5]) : device_log::LEVEL_UNKNOWN;
 
-	printf("Opening Device\n");
-	// open device
-	device_imu = open_device(3);
-	if (!device_imu) {
-		printf("Unable to open device\n");
+	int count = 0;
+	if (device_log::query(argv[2], q, print_log_entry, &count) < 0) {
+		printf("Unable to open log store %s\n", argv[2]);
 		return 1;
 	}
+	std::cout << std::dec << count << " entries" << std::endl;
+	return 0;
+}
 
-	device_control = open_device(4);
-	if (!device_control) {
-		printf("Unable to open device\n");
-		return 1;
+// sleep most of the way, then spin so steps leave on time rather than on the scheduler tick
+static void
+wait_until(std::chrono::steady_clock::time_point deadline)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (deadline - now > std::chrono::milliseconds(2)) {
+		std::this_thread::sleep_for(deadline - now - std::chrono::milliseconds(2));
+	}
+	while (std::chrono::steady_clock::now() < deadline) {
 	}
+}
 
-	int res_control, res_read;
-	std::string msg_str;
+// reads until a reply with the expected msgId arrives, pushes in between are skipped
+static bool
+wait_reply(transport* device, const script::step& s, std::chrono::steady_clock::time_point deadline, uint8_t* status)
+{
+	uint8_t read_buf[1024];
 
+	while (true) {
+		int remaining_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (remaining_ms < 0) return false;
+
+		int res = device->read(read_buf, sizeof(read_buf), remaining_ms);
+		if (res <= 0) return false;
+
+		if (s.target == script::TARGET_IMU) {
+			if (read_buf[0] != 0xaa) continue; // IMU stream reports
+			protocol3::parsed_rsp result;
+			protocol3::parse_rsp(read_buf, res, &result);
+			if (result.msgId == s.expect_msgId) {
+				*status = 0;
+				return true;
+			}
+		}
+		else {
+			protocol::parsed_rsp result;
+			protocol::parse_rsp(read_buf, res, &result);
+			if (dev_log.is_open() && result.msgId == protocol::ASYNC_TEXT_LOG) {
+				dev_log.feed(result.payload, result.payload_size, device_log::now_ms());
+			}
+			if (result.msgId == s.expect_msgId) {
+				*status = result.status;
+				return true;
+			}
+		}
+	}
+}
 
-	msg_str = "GET_STATIC_ID";
-	res_control = write_imu(device_imu, msg_str, nullptr, 0);
-	res_read = read_imu(device_imu, -1); 
+static int
+run_script(transport* device_imu, transport* device_control, const std::vector<script::step>& steps)
+{
+	int failures = 0;
+	int replies = 0;
+	long long latency_total_us = 0, latency_min_us = -1, latency_max_us = 0;
+	int step_no = 0;
+
+	std::chrono::steady_clock::time_point last_sent = std::chrono::steady_clock::now();
+
+	for (const script::step& s : steps) {
+		transport* device = s.target == script::TARGET_IMU ? device_imu : device_control;
+
+		for (uint32_t r = 0; r < s.repeat; r++) {
+			step_no++;
+			wait_until(last_sent + std::chrono::milliseconds(s.delay_ms));
+
+			std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+			int res = device->write(s.frame, s.frame_len);
+			double since_prev_ms = std::chrono::duration<double, std::milli>(sent - last_sent).count();
+			last_sent = sent;
+
+			std::cout << "[" << std::dec << std::setw(4) << std::setfill(' ') << step_no << "] line " << s.line << " "
+				<< (s.target == script::TARGET_IMU ? "imu " : "control ") << s.name
+				<< " +" << std::fixed << std::setprecision(3) << since_prev_ms << " ms";
 
+			if (res < 0) {
+				std::cout << ": write failed" << std::endl;
+				failures++;
+				continue;
+			}
+
+			if (s.expect) {
+				uint8_t status = 0;
+				if (wait_reply(device, s, sent + std::chrono::milliseconds(s.timeout_ms), &status)) {
+					long long us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent).count();
+					std::cout << ", reply status 0x" << std::hex << std::setw(2) << std::setfill('0') << (int)status << std::dec << " in " << us << " us";
+					replies++;
+					latency_total_us += us;
+					latency_max_us = us > latency_max_us ? us : latency_max_us;
+					latency_min_us = (latency_min_us < 0 || us < latency_min_us) ? us : latency_min_us;
+				}
+				else {
+					std::cout << ", no reply within " << s.timeout_ms << " ms";
+					failures++;
+				}
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	std::cout << std::dec << step_no << " steps, " << failures << " failed";
+	if (replies > 0) {
+		std::cout << ", reply latency min/avg/max " << latency_min_us << "/" << latency_total_us / replies << "/" << latency_max_us << " us";
+	}
+	std::cout << std::endl;
+
+	return failures == 0 ? 0 : 2;
+}
+
+// downloads the calibration json from the IMU interface
+static bool
+read_calibration(transport* device_imu, std::string* json, bool print)
+{
+	std::string msg_str;
+	int res_read;
 	protocol3::parsed_rsp result;
 	
 	msg_str = "GET_CAL_DATA_LENGTH";
-	res_control = write_imu(device_imu, msg_str, nullptr, 0);
+	write_imu(device_imu, msg_str, nullptr, 0);
 	res_read = read_imu_get_rsp(device_imu, -1, &result);
 
-	if (result.msgId == protocol3::hexForKey(msg_str) && result.payload_size == 4) {
-		uint32_t cal_data_len = (result.payload[0] | result.payload[1] << 8 | result.payload[2] << 16 | result.payload[3] << 24);
-		uint32_t remaining_bytes = cal_data_len;
-		std::cout << "Calibration data bytes: " << std::dec << cal_data_len << std::endl;
+	protocol_codec::cal_data_length length;
+	if (result.msgId != protocol3::GET_CAL_DATA_LENGTH || !protocol_codec::decode(result.payload, result.payload_size, &length)) {
+		return false;
+	}
+
+	uint32_t cal_data_len = length.length;
+	uint32_t remaining_bytes = cal_data_len;
+	std::cout << "Calibration data bytes: " << std::dec << cal_data_len << std::endl;
 
+	while (remaining_bytes > 0) {
+		msg_str = "CAL_DATA_GET_NEXT_SEGMENT";
+		write_imu(device_imu, msg_str, nullptr, 0);
+		res_read = read_imu_get_rsp(device_imu, -1, &result);
 
+		uint16_t last_bytes = result.payload_size;
 
-		while (remaining_bytes > 0) {
-			msg_str = "CAL_DATA_GET_NEXT_SEGMENT";
-			res_control = write_imu(device_imu, msg_str, nullptr, 0);
-			res_read = read_imu_get_rsp(device_imu, -1, &result);
+		// a failed read or corrupt segment would otherwise spin here forever or wrap the count
+		if (res_read <= 0 || !result.valid || last_bytes == 0 || last_bytes > remaining_bytes) {
+			std::cout << std::endl << "Calibration download aborted, " << std::dec << remaining_bytes << " bytes remaining" << std::endl;
+			return false;
+		}
+
+		remaining_bytes -= last_bytes;
+		json->append((const char*)result.payload, result.payload_size);
+		if (print) print_chars(result.payload, result.payload_size);
+		//std::cout << "Packet bytes: " << std::dec << last_bytes <<  " , Bytes remaining: " << remaining_bytes << std::endl;
+	}
 
-			uint16_t last_bytes = result.payload_size;
+	return true;
+}
+
+static volatile sig_atomic_t stop_requested = 0;
 
-			remaining_bytes -= last_bytes;
-			print_chars(result.payload, result.payload_size);
-			//std::cout << "Packet bytes: " << std::dec << last_bytes <<  " , Bytes remaining: " << remaining_bytes << std::endl;
+static void
+on_stop_signal(int)
+{
+	stop_requested = 1;
+}
+
+// streams calibrated IMU samples into a columnar export until ctrl-c,
+// low-pass filtered and decimated first when rate_hz is set
+static int
+export_imu(transport* device_imu, const char* path, float rate_hz)
+{
+	imu::calibration cal;
+	imu::default_calibration(&cal);
 
+	std::string cal_json;
+	if (!read_calibration(device_imu, &cal_json, false) || !imu::load_calibration(cal_json.data(), cal_json.size(), &cal)) {
+		printf("No calibration data, exporting uncalibrated samples\n");
+	}
+
+	imu_export exporter;
+	if (!exporter.open(path)) {
+		printf("Unable to open %s\n", path);
+		return 1;
+	}
+
+	imu_decimator decimator((float)imu::NOMINAL_RATE_HZ);
+	int stream = rate_hz > 0 ? decimator.add_stream(rate_hz, 64) : -1;
+	if (stream >= 0) {
+		printf("Exporting at %.1f Hz (1/%d, %d taps)\n", decimator.rate(stream), decimator.factor(stream), decimator.taps(stream));
+	}
+
+	signal(SIGINT, on_stop_signal);
+	rt_thread::apply(reader_rt, "reader");
+
+	write_imu_stream(device_imu, true);
+
+	uint8_t read_buf[1024];
+	imu::sample sample;
+
+	while (!stop_requested) {
+		int res = device_imu->read(read_buf, sizeof(read_buf), 100);
+		if (res < 0) {
+			printf("Unable to read from device\n");
+			break;
+		}
+		if (imu::parse_sample(read_buf, res, &sample)) {
+			imu::apply_calibration(cal, &sample);
+			if (stream >= 0) {
+				decimator.push(sample);
+				if (!decimator.ring(stream).pop(&sample)) continue;
+			}
+			if (!exporter.add(sample)) {
+				printf("Unable to write %s\n", path);
+				break;
+			}
 		}
+	}
+
+	write_imu_stream(device_imu, false);
 
+	bool ok = exporter.close();
+	std::cout << std::dec << exporter.samples_written() << " samples written to " << path << std::endl;
+	return ok ? 0 : 1;
+}
+
+static int
+send_control(void* ctx, uint16_t msgId, const uint8_t* p_buf, int p_size)
+{
+	return write_control(static_cast<transport*>(ctx), msgId, p_buf, p_size);
+}
+
+// reads control responses into the controller until it has nothing outstanding, a query
+// included, or max_wait runs out
+static void
+drive_display_mode(transport* device_control, display_mode* controller, std::chrono::milliseconds max_wait)
+{
+	std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now() + max_wait;
+	protocol::parsed_rsp result;
+
+	while (std::chrono::steady_clock::now() < give_up) {
+		int res = read_control_get_rsp(device_control, 20, &result);
+		if (res < 0) break;
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (res > 0) controller->on_rsp(result, now);
+		controller->poll(now);
+
+		if (controller->idle()) break;
+	}
+}
+
+// --display-mode <mode>[,<mode>...], back-to-back modes are coalesced by the controller
+static int
+set_display_mode(transport* device_control, const char* modes)
+{
+	display_mode controller(send_control, device_control);
+
+	controller.query(std::chrono::steady_clock::now());
+	drive_display_mode(device_control, &controller, std::chrono::milliseconds(300));
+	std::cout << "Display mode: " << display_mode::mode_name(controller.current()) << std::endl;
+
+	std::string list(modes);
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		std::string name = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+		display_mode::mode_t mode = display_mode::mode_for_name(name);
+
+		if (mode == display_mode::MODE_UNKNOWN) {
+			printf("Unknown display mode %s\n", name.c_str());
+			return 1;
+		}
+		controller.request(mode, std::chrono::steady_clock::now());
+
+		if (end == std::string::npos) break;
+		start = end + 1;
+	}
+
+	drive_display_mode(device_control, &controller, std::chrono::seconds(5));
+
+	const display_mode::stats_t& st = controller.stats();
+	std::cout << "Display mode: " << display_mode::mode_name(controller.current())
+		<< ", writes " << std::dec << st.writes << ", skipped " << st.skipped << ", coalesced " << st.coalesced
+		<< ", retries " << st.retries << ", failures " << st.failures;
+	if (st.confirmed > 0) {
+		std::cout << ", switch latency min/avg/max " << std::fixed << std::setprecision(1)
+			<< st.min_ms << "/" << st.total_ms / st.confirmed << "/" << st.max_ms << " ms";
 	}
+	std::cout << std::endl;
+
+	return controller.settled() ? 0 : 2;
+}
+
+static void
+on_button(const event_bus::event& e, void*)
+{
+	std::cout << "Button " << std::dec << (int)e.button << ", brightness " << (int)e.brightness << std::endl;
+}
+
+static void
+on_heartbeat(const event_bus::event& e, void*)
+{
+	std::cout << protocol::keyForHex(e.rsp.msgId) << std::endl;
+}
+
+static void
+on_text_log(const event_bus::event& e, void*)
+{
+	if (dev_log.is_open()) {
+		dev_log.feed(e.rsp.payload, e.rsp.payload_size, device_log::now_ms());
+	}
+	else {
+		print_chars(e.rsp.payload, e.rsp.payload_size);
+	}
+}
+
+static void
+apply_rt(void* ctx)
+{
+	const rt_thread::config* cfg = static_cast<const rt_thread::config*>(ctx);
+	rt_thread::apply(*cfg, cfg == &logger_rt ? "logger" : "dispatcher");
+}
+
+// reader thread: nothing but hid_read and a lock-free publish, device log lines go to their own bus
+static void
+read_pushes(transport* device_control, event_bus* bus, event_bus* log_bus)
+{
+	uint8_t read_buf[1024];
+	protocol::parsed_rsp result;
+
+	rt_thread::apply(reader_rt, "reader");
+
+	while (!stop_requested) {
+		int res = device_control->read(read_buf, sizeof(read_buf), 100);
+		if (res < 0) {
+			printf("Unable to read from device\n");
+			stop_requested = 1;
+			break;
+		}
+		if (res == 0) continue;
+
+		std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now();
+		protocol::parse_rsp(read_buf, res, &result);
+		if (!result.valid) continue;
+
+		if (result.msgId == protocol::ASYNC_TEXT_LOG) log_bus->publish(result, received);
+		else bus->publish(result, received);
+	}
+}
+
+static void
+print_bus_stats(const char* name, const event_bus& bus)
+{
+	const latency_histogram& lat = bus.latency();
+	std::cout << name << ": " << std::dec << bus.published() << " published, " << bus.dropped() << " dropped, latency us p50/p99/p99.9/max "
+		<< std::fixed << std::setprecision(1) << lat.percentile(50) / 1000.0 << "/" << lat.percentile(99) / 1000.0 << "/"
+		<< lat.percentile(99.9) / 1000.0 << "/" << lat.max() / 1000.0 << std::endl;
+}
+
+// --listen: deliver control interface pushes to subscribers until ctrl-c
+static int
+listen_pushes(transport* device_control)
+{
+	event_bus bus;
+	event_bus log_bus;
+
+	bus.subscribe(protocol::P_BUTTON_PRESSED, on_button, nullptr);
+	bus.subscribe(protocol::P_UKNOWN_HEARTBEAT, on_heartbeat, nullptr);
+	bus.subscribe(protocol::P_UKNOWN_HEARTBEAT_2, on_heartbeat, nullptr);
+	log_bus.subscribe(protocol::ASYNC_TEXT_LOG, on_text_log, nullptr);
+
+	bus.set_thread_init(apply_rt, &dispatcher_rt);
+	log_bus.set_thread_init(apply_rt, &logger_rt);
+
+	std::cout << "reader: " << rt_thread::describe(reader_rt) << std::endl;
+	std::cout << "dispatcher: " << rt_thread::describe(dispatcher_rt) << std::endl;
+	std::cout << "logger: " << rt_thread::describe(logger_rt) << std::endl;
+
+	signal(SIGINT, on_stop_signal);
+	bus.start();
+	log_bus.start();
+
+	std::thread reader(read_pushes, device_control, &bus, &log_bus);
+	reader.join();
+	bus.stop();
+	log_bus.stop();
+
+	print_bus_stats("events", bus);
+	print_bus_stats("device log", log_bus);
+	return 0;
+}
+
+// dashboard reader thread for one interface, counts and nothing else
+static void
+read_dashboard(transport* device, int interface_num, dashboard* board)
+{
+	uint8_t read_buf[1024];
+
+	rt_thread::apply(reader_rt, "reader");
+
+	while (!stop_requested) {
+		int res = device->read(read_buf, sizeof(read_buf), 100);
+		if (res < 0) {
+			board->on_read_error(interface_num);
+			break;
+		}
+		if (res == 0) continue;
+
+		if (interface_num == 3) board->on_imu(read_buf, res);
+		else board->on_control(read_buf, res, dashboard::now_ns());
+	}
+}
+
+// --dashboard: live rates, round trip, health and display mode, redrawn twice a second
+static int
+run_dashboard(transport* device_imu, transport* device_control)
+{
+	dashboard board;
+
+	// the frame is redrawn with VT escapes, which the Windows console needs asking for
+	HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+	DWORD console_mode = 0;
+	if (GetConsoleMode(console, &console_mode)) SetConsoleMode(console, console_mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+	print_packets = false;
+	signal(SIGINT, on_stop_signal);
+
+	write_imu_stream(device_imu, true);
+
+	std::thread imu_reader(read_dashboard, device_imu, 3, &board);
+	std::thread control_reader(read_dashboard, device_control, 4, &board);
+
+	std::chrono::steady_clock::time_point next_probe = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point next_render = next_probe;
+	std::chrono::steady_clock::time_point next_mode = next_probe;
+
+	while (!stop_requested) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		if (now >= next_probe) {
+			board.probe_sent(protocol::HEARTBEAT, dashboard::now_ns());
+			write_control(device_control, protocol::HEARTBEAT, nullptr, 0);
+			next_probe = now + std::chrono::milliseconds(250);
+		}
+		if (now >= next_mode) {
+			write_control(device_control, protocol::R_DISP_MODE, nullptr, 0);
+			next_mode = now + std::chrono::seconds(5);
+		}
+		if (now >= next_render) {
+			board.render(std::cout, dashboard::now_ns());
+			next_render = now + std::chrono::milliseconds(500);
+		}
+
+		std::this_thread::sleep_until(std::min(next_probe, std::min(next_mode, next_render)));
+	}
+
+	imu_reader.join();
+	control_reader.join();
+
+	write_imu_stream(device_imu, false);
+	return 0;
+}
+
+// --soak reader: the same parse, calibrate and decimate path as --export-imu, timed from
+// the moment the simulated device made the report; any heap allocation in an iteration is counted
+static void
+soak_imu_reader(sim_device* sim, const imu::calibration* cal, imu_decimator* decimator, soak* run)
+{
+	uint8_t read_buf[1024];
+	imu::sample sample;
+	transport* device_imu = sim->imu();
+
+	rt_thread::apply(reader_rt, "reader");
+
+	while (!stop_requested) {
+		uint64_t allocs = alloc_tracker::count();
+		int res = device_imu->read(read_buf, sizeof(read_buf), 100);
+		if (res < 0) {
+			printf("Unable to read from device\n");
+			stop_requested = 1;
+			break;
+		}
+		if (!imu::parse_sample(read_buf, res, &sample)) continue;
+
+		imu::apply_calibration(*cal, &sample);
+		decimator->push(sample);
+
+		std::chrono::steady_clock::time_point made = sim->epoch() + std::chrono::nanoseconds(sample.timestamp);
+		run->imu_received((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - made).count());
+		if (alloc_tracker::count() != allocs) run->imu_allocated(alloc_tracker::count() - allocs);
+	}
+}
+
+// drains every decimator output at a render loop's pace
+static void
+soak_consumer(imu_decimator* decimator)
+{
+	imu::sample batch[64];
+
+	while (!stop_requested) {
+		for (int i = 0; i < decimator->streams(); i++) {
+			while (decimator->ring(i).pop_batch(batch, 64) == 64) {}
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+// one command in flight at a time, each waits for its own reply before the next goes out
+static void
+soak_commands(transport* device_control, float rate, soak* run)
+{
+	static const uint16_t rotation[] = { protocol::HEARTBEAT, protocol::R_DISP_MODE, protocol::R_MCU_APP_FW_VERSION, protocol::W_DISP_MODE };
+	const std::chrono::nanoseconds period((int64_t)(1e9 / rate));
+	const std::chrono::milliseconds reply_timeout(100);
+
+	uint8_t mode_buf[4];
+	int mode_size = display_mode::encode(display_mode::MODE_2D_1080_60, mode_buf, sizeof(mode_buf));
+	protocol::parsed_rsp result;
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+	for (uint32_t n = 0; !stop_requested; n++) {
+		uint64_t allocs = alloc_tracker::count();
+		uint16_t msgId = rotation[n % (sizeof(rotation) / sizeof(rotation[0]))];
+		bool with_mode = msgId == protocol::W_DISP_MODE;
+
+		std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+		if (write_control(device_control, msgId, with_mode ? mode_buf : nullptr, with_mode ? mode_size : 0) != 0) break;
+		run->command_sent();
+
+		bool replied = false;
+		std::chrono::steady_clock::time_point now = sent;
+		while (!replied && now < sent + reply_timeout) {
+			int wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(sent + reply_timeout - now).count() + 1;
+			int res = read_control_get_rsp(device_control, wait_ms, &result);
+			if (res < 0) break;
+
+			now = std::chrono::steady_clock::now();
+			// heartbeat pushes arrive in between, only the matching reply counts
+			if (res > 0 && result.valid && result.msgId == msgId) {
+				run->command_replied((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent).count());
+				replied = true;
+			}
+		}
+		if (!replied) run->command_lost();
+		if (alloc_tracker::count() != allocs) run->command_allocated(alloc_tracker::count() - allocs);
+
+		// a late reply delays the schedule rather than bunching the next commands up
+		next += period;
+		if (next < now) next = now;
+		std::this_thread::sleep_until(next);
+	}
+}
+
+// --soak <spec>: the full stack against sim_device for hours, checked every interval
+static int
+run_soak(const soak::config& cfg)
+{
+	sim_device sim;
+	soak run(cfg);
+
+	if (!run.open_csv()) {
+		printf("Unable to create %s\n", cfg.csv_path.c_str());
+		return 1;
+	}
+	std::cout << "soak: " << soak::describe(cfg) << std::endl;
+
+	print_packets = false;
+	signal(SIGINT, on_stop_signal);
+
+	imu::calibration cal;
+	imu::default_calibration(&cal);
+	std::string cal_json;
+	if (!read_calibration(sim.imu(), &cal_json, false) || !imu::load_calibration(cal_json.data(), cal_json.size(), &cal)) {
+		printf("No calibration data from the simulator\n");
+		return 1;
+	}
+
+	// a full rate and a 100 Hz output, like a pose filter and a UI consumer
+	imu_decimator decimator((float)imu::NOMINAL_RATE_HZ);
+	decimator.add_stream((float)imu::NOMINAL_RATE_HZ, 1024);
+	decimator.add_stream(100.0f, 64);
+
+	size_t step = 0;
+	sim.set_imu_rate(cfg.imu_rates[0]);
+	write_imu_stream(sim.imu(), true);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread imu_reader(soak_imu_reader, &sim, &cal, &decimator, &run);
+	std::thread consumer(soak_consumer, &decimator);
+	std::thread commands;
+	if (cfg.command_rate > 0) commands = std::thread(soak_commands, sim.control(), cfg.command_rate, &run);
+
+	const double step_s = cfg.duration_s / cfg.imu_rates.size();
+	double elapsed = 0;
+	std::chrono::steady_clock::time_point next_report = start + std::chrono::milliseconds((int64_t)(cfg.interval_s * 1000));
+
+	while (!stop_requested && elapsed < cfg.duration_s) {
+		std::this_thread::sleep_until(std::min(next_report, start + std::chrono::milliseconds((int64_t)(cfg.duration_s * 1000))));
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		uint64_t dropped = sim.reports_dropped();
+		for (int i = 0; i < decimator.streams(); i++)
+			dropped += decimator.dropped(i);
+
+		if (!run.report(elapsed, cfg.imu_rates[step], sim.reports_sent(), dropped)) break;
+		next_report += std::chrono::milliseconds((int64_t)(cfg.interval_s * 1000));
+
+		size_t next_step = std::min((size_t)(elapsed / step_s), cfg.imu_rates.size() - 1);
+		if (next_step != step) {
+			step = next_step;
+			sim.set_imu_rate(cfg.imu_rates[step]);
+		}
+	}
+
+	stop_requested = 1;
+	imu_reader.join();
+	consumer.join();
+	if (commands.joinable()) commands.join();
+	write_imu_stream(sim.imu(), false);
+
+	return run.finish(elapsed) ? 0 : 2;
+}
+
+static task<std::string>
+download_calibration(async_device& imu)
+{
+	std::string json;
+
+	protocol_codec::cal_data_length length;
+	protocol::parsed_rsp result = co_await imu.send(protocol3::GET_CAL_DATA_LENGTH);
+	if (!result.valid || !protocol_codec::decode(result.payload, result.payload_size, &length)) co_return json;
+
+	uint32_t remaining_bytes = length.length;
+
+	while (remaining_bytes > 0) {
+		result = co_await imu.send(protocol3::CAL_DATA_GET_NEXT_SEGMENT);
+		if (!result.valid || result.payload_size == 0 || result.payload_size > remaining_bytes) break;
+
+		json.append((const char*)result.payload, result.payload_size);
+		remaining_bytes -= result.payload_size;
+	}
+	co_return json;
+}
+
+static task<>
+calibration_sequence(async_device& imu)
+{
+	std::string json = co_await download_calibration(imu);
+	std::cout << "Calibration data bytes: " << std::dec << json.size() << std::endl;
+}
+
+static task<>
+version_sequence(async_device& control)
+{
+	const char* queries[] = { "R_GLASSID", "R_MCU_APP_FW_VERSION", "R_DSP_APP_FW_VERSION", "R_DP7911_FW_VERSION", "R_DSP_VERSION" };
+
+	for (const char* name : queries) {
+		protocol::parsed_rsp result = co_await control.send(name);
+		std::cout << name << ": ";
+		if (result.valid && result.payload_size > 1) print_chars(&result.payload[1], result.payload_size - 1); // skip the status byte
+		else std::cout << "no reply";
+		std::cout << std::endl;
+	}
+}
+
+// --async: version queries and the calibration download interleaved on one thread
+static int
+run_async(transport* device_imu, transport* device_control)
+{
+	event_loop loop;
+	async_device imu(loop, device_imu, async_device::PROTOCOL_IMU);
+	async_device control(loop, device_control, async_device::PROTOCOL_CONTROL);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	loop.spawn(calibration_sequence(imu));
+	loop.spawn(version_sequence(control));
+	loop.run();
+
+	std::cout << "Sequences finished in " << std::dec << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "--query-log") == 0) {
+		return query_log(argc, argv);
+	}
+
+	std::vector<script::step> steps;
+	const char* export_path = nullptr;
+	float export_rate = 0;
+	const char* capture_base = nullptr;
+	const char* replay_base = nullptr;
+	double replay_speed = 1.0;
+	double replay_seek_s = 0;
+	const char* display_modes = nullptr;
+	bool listen = false;
+	bool async = false;
+	bool show_dashboard = false;
+	bool soak_run = false;
+	soak::config soak_cfg;
+
+	rt_thread::default_config(&reader_rt);
+	rt_thread::default_config(&dispatcher_rt);
+	rt_thread::default_config(&logger_rt);
+	soak::default_config(&soak_cfg);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--list") == 0) {
+			protocol::listKnownCommands();
+			protocol3::listKnownCommands();
+			return 0;
+		}
+		if (strcmp(argv[i], "--listen") == 0) {
+			listen = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--async") == 0) {
+			async = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--dashboard") == 0) {
+			show_dashboard = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--quiet") == 0) {
+			print_packets = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--mlock") == 0) {
+			if (!rt_thread::lock_memory()) return 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			printf("Unknown or incomplete option %s\n", argv[i]);
+			return 1;
+		}
+
+		if (strcmp(argv[i], "--log") == 0) {
+			// stores ASYNC_TEXT_LOG lines instead of printing them
+			if (!dev_log.open(argv[i + 1])) {
+				printf("Unable to open log store %s\n", argv[i + 1]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--script") == 0) {
+			if (!script::load_file(argv[i + 1], &steps)) return 1;
+		}
+		else if (strcmp(argv[i], "--run") == 0) {
+			if (!script::parse_text(argv[i + 1], ';', &steps)) return 1;
+		}
+		else if (strcmp(argv[i], "--export-imu") == 0) {
+			export_path = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--export-rate") == 0) {
+			export_rate = (float)atof(argv[i + 1]);
+			if (export_rate <= 0) {
+				printf("--export-rate expects a rate in Hz\n");
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--capture") == 0) {
+			capture_base = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--replay") == 0) {
+			replay_base = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--speed") == 0) {
+			// 0 replays as fast as possible
+			replay_speed = atof(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--seek") == 0) {
+			replay_seek_s = atof(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--display-mode") == 0) {
+			display_modes = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "--soak") == 0) {
+			std::string error;
+			if (!soak::parse(argv[i + 1], &soak_cfg, &error)) {
+				printf("--soak: %s\n", error.c_str());
+				return 1;
+			}
+			soak_run = true;
+		}
+		else if (strcmp(argv[i], "--rt") == 0) {
+			std::string arg(argv[i + 1]), error;
+			size_t colon = arg.find(':');
+			std::string name = arg.substr(0, colon);
+			rt_thread::config* cfg = name == "reader" ? &reader_rt : name == "dispatcher" ? &dispatcher_rt : name == "logger" ? &logger_rt : nullptr;
+
+			if (cfg == nullptr || colon == std::string::npos) {
+				printf("--rt expects reader|dispatcher|logger:<settings>\n");
+				return 1;
+			}
+			if (!rt_thread::parse(arg.substr(colon + 1), cfg, &error)) {
+				printf("--rt %s: %s\n", name.c_str(), error.c_str());
+				return 1;
+			}
+		}
+		else {
+			printf("Unknown option %s\n", argv[i]);
+			return 1;
+		}
+		i++;
+	}
+
+	transport* device_imu;
+	transport* device_control;
+
+	uint8_t cmd_buf[64];
+
+	std::unique_ptr<hid_transport> hid_imu, hid_control;
+	std::unique_ptr<capture_transport> capture_imu, capture_control;
+	std::unique_ptr<replay_transport> replay_imu, replay_control;
+	std::chrono::steady_clock::time_point session_origin = std::chrono::steady_clock::now();
+
+	if (soak_run) {
+		if (show_dashboard) {
+			// the soak's reader threads own both simulated interfaces, a second reader would steal their reports
+			printf("--dashboard cannot attach to --soak, run them separately\n");
+			return 1;
+		}
+		return run_soak(soak_cfg);
+	}
+
+	if (replay_base != nullptr) {
+		// a recorded session stands in for the glasses, both interfaces on one schedule
+		std::string base(replay_base);
+		replay_imu.reset(new replay_transport());
+		replay_control.reset(new replay_transport());
+		if (!replay_imu->open(base + ".imu.cap", replay_speed, session_origin) || !replay_control->open(base + ".control.cap", replay_speed, session_origin)) {
+			printf("Unable to open capture %s\n", replay_base);
+			return 1;
+		}
+		if (replay_seek_s > 0) {
+			uint64_t seek_ns = (uint64_t)(replay_seek_s * 1e9);
+			replay_imu->seek(seek_ns, session_origin);
+			replay_control->seek(seek_ns, session_origin);
+		}
+		device_imu = replay_imu.get();
+		device_control = replay_control.get();
+	}
+	else {
+		printf("Opening Device\n");
+		// open device
+		hid_device* handle_imu = open_device(3);
+		if (!handle_imu) {
+			printf("Unable to open device\n");
+			return 1;
+		}
+
+		hid_device* handle_control = open_device(4);
+		if (!handle_control) {
+			printf("Unable to open device\n");
+			return 1;
+		}
+
+		hid_imu.reset(new hid_transport(handle_imu));
+		hid_control.reset(new hid_transport(handle_control));
+		device_imu = hid_imu.get();
+		device_control = hid_control.get();
+	}
+
+	if (capture_base != nullptr) {
+		std::string base(capture_base);
+		capture_imu.reset(new capture_transport(device_imu, session_origin));
+		capture_control.reset(new capture_transport(device_control, session_origin));
+		if (!capture_imu->open(base + ".imu.cap", 3) || !capture_control->open(base + ".control.cap", 4)) {
+			printf("Unable to create capture %s\n", capture_base);
+			return 1;
+		}
+		device_imu = capture_imu.get();
+		device_control = capture_control.get();
+	}
+
+	if (!steps.empty()) {
+		return run_script(device_imu, device_control, steps);
+	}
+
+	if (export_path != nullptr) {
+		return export_imu(device_imu, export_path, export_rate);
+	}
+
+	if (display_modes != nullptr) {
+		return set_display_mode(device_control, display_modes);
+	}
+
+	if (listen) {
+		return listen_pushes(device_control);
+	}
+
+	if (async) {
+		return run_async(device_imu, device_control);
+	}
+
+	if (show_dashboard) {
+		return run_dashboard(device_imu, device_control);
+	}
+
+	int res_control, res_read;
+	std::string msg_str;
+
+
+	msg_str = "GET_STATIC_ID";
+	res_control = write_imu(device_imu, msg_str, nullptr, 0);
+	res_read = read_imu(device_imu, -1); 
+
+	std::string cal_json;
+	read_calibration(device_imu, &cal_json, true);
 
 
 	
@@ -0,0 +1,525 @@
+#include "real_utilities_c.h"
+#include "protocol.h"
+#include "protocol3.h"
+#include "protocol_codec.h"
+#include "imu.h"
+#include "hid_transport.h"
+#include "imu_decimator.h"
+
+#ifdef _WIN32
+#include "hidapi-win/include/hidapi.h"
+#else
+#include <hidapi/hidapi.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Air USB VID and PID
+#define AIR_VID 0x3318
+#define AIR_PID 0x0424
+
+// ru_imu_sample is frozen, any change to it breaks every caller's array stride
+static_assert(sizeof(ru_imu_sample) == 48, "ru_imu_sample layout is part of the ABI");
+
+struct stream_wait {
+    std::mutex lock;
+    std::condition_variable cv;
+    // the ring has a single consumer, further readers of the stream wait here for their turn
+    bool reader_busy = false;
+    std::condition_variable turn;
+    std::atomic<bool> consumer_waiting{ false };
+};
+
+struct ru_device {
+    hid_device* control_handle;
+    hid_device* imu_handle;
+    std::unique_ptr<hid_transport> control;
+    std::unique_ptr<hid_transport> imu;
+
+    std::mutex control_lock;     // one ru_send at a time per interface
+    std::mutex imu_lock;
+
+    // while streaming the reader thread owns IMU reads and hands replies over here
+    std::mutex mailbox_lock;
+    std::condition_variable mailbox_cv;
+    bool mailbox_waiting;
+    bool mailbox_full;
+    uint8_t mailbox_id;
+    protocol3::parsed_rsp mailbox_rsp;
+
+    std::thread reader;
+    std::atomic<bool> streaming; // claimed by ru_imu_start, cleared by ru_imu_stop
+    std::atomic<bool> reading;   // the reader thread is running, changed under imu_lock
+    imu::calibration cal;
+
+    // ru_imu_read_stream holds it shared while it uses the rings, start and stop hold it
+    // exclusive to set them up and tear them down
+    std::shared_mutex stream_lock;
+
+    // stream 0 is the full rate, the rest come from ru_imu_add_stream
+    std::vector<float> stream_rates;
+    std::vector<uint32_t> stream_capacities;
+    std::unique_ptr<imu_decimator> decimator;
+    std::unique_ptr<stream_wait[]> waits;
+};
+
+static hid_device*
+open_interface(int interface_num)
+{
+    struct hid_device_info* devs = hid_enumerate(AIR_VID, AIR_PID);
+    hid_device* device = nullptr;
+
+    for (struct hid_device_info* cur_dev = devs; cur_dev != nullptr; cur_dev = cur_dev->next) {
+        if (cur_dev->interface_number == interface_num) {
+            device = hid_open_path(cur_dev->path);
+            break;
+        }
+    }
+
+    hid_free_enumeration(devs);
+    return device;
+}
+
+// hid_init/hid_exit are process wide, devices can be opened from several threads
+static std::mutex hid_lock;
+static int hid_users = 0;
+
+static bool
+hid_acquire()
+{
+    std::lock_guard<std::mutex> lock(hid_lock);
+    if (hid_users == 0 && hid_init() != 0) return false;
+    hid_users++;
+    return true;
+}
+
+static void
+hid_release()
+{
+    std::lock_guard<std::mutex> lock(hid_lock);
+    if (--hid_users == 0) hid_exit();
+}
+
+static int
+remaining_ms(std::chrono::steady_clock::time_point deadline)
+{
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    return ms < 0 ? 0 : (int)ms;
+}
+
+static int
+copy_reply(const uint8_t* payload, int payload_size, uint8_t* reply, int reply_capacity)
+{
+    if (reply == nullptr || reply_capacity < payload_size) return RU_ERR_TOO_SMALL;
+    memcpy(reply, payload, payload_size);
+    return payload_size;
+}
+
+static int
+write_frame(transport* t, int interface_num, uint16_t msg_id, const uint8_t* payload, int payload_size)
+{
+    uint8_t cmd_buf[1024];
+    std::fill(cmd_buf, cmd_buf + sizeof(cmd_buf), 0);
+
+    int cmd_len = interface_num == RU_INTERFACE_IMU
+        ? protocol3::cmd_build((uint8_t)msg_id, payload, payload_size, &cmd_buf[1], sizeof(cmd_buf) - 1)
+        : protocol::cmd_build(msg_id, payload, payload_size, &cmd_buf[1], sizeof(cmd_buf) - 1);
+    if (cmd_len == 0) return RU_ERR_INVALID_ARG;
+
+    return t->write(cmd_buf, cmd_len + 1) < 0 ? RU_ERR_IO : RU_OK;
+}
+
+static int
+write_imu_stream(transport* t, bool enable)
+{
+    protocol_codec::imu_stream_request request;
+    request.enable = enable ? 1 : 0;
+
+    uint8_t payload[protocol_codec::imu_stream_request::SIZE];
+    int payload_size = protocol_codec::encode(request, payload, sizeof(payload));
+    return write_frame(t, RU_INTERFACE_IMU, protocol3::START_IMU_DATA, payload, payload_size);
+}
+
+static void
+read_imu_stream(ru_device* dev)
+{
+    uint8_t read_buf[1024];
+    imu::sample sample;
+
+    while (dev->streaming.load(std::memory_order_relaxed)) {
+        int res = dev->imu->read(read_buf, sizeof(read_buf), 100);
+        if (res <= 0) continue;
+
+        if (imu::parse_sample(read_buf, res, &sample)) {
+            imu::apply_calibration(dev->cal, &sample);
+
+            // only the streams that produced an output can have a reader to wake
+            uint32_t produced = dev->decimator->push(sample);
+            if (produced == 0) continue;
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (int i = 0; i < dev->decimator->streams(); i++) {
+                stream_wait& w = dev->waits[i];
+                if ((produced & (1u << i)) && w.consumer_waiting.load(std::memory_order_relaxed)) {
+                    std::lock_guard<std::mutex> lock(w.lock);
+                    w.cv.notify_one();
+                }
+            }
+            continue;
+        }
+
+        protocol3::parsed_rsp rsp;
+        protocol3::parse_rsp(read_buf, res, &rsp);
+
+        std::lock_guard<std::mutex> lock(dev->mailbox_lock);
+        if (dev->mailbox_waiting && !dev->mailbox_full && rsp.valid && rsp.msgId == dev->mailbox_id) {
+            dev->mailbox_rsp = rsp;
+            dev->mailbox_full = true;
+            dev->mailbox_cv.notify_one();
+        }
+    }
+}
+
+// pop in chunks and copy field by field, imu::sample may change but ru_imu_sample may not
+static int
+pop_samples(spsc_ring<imu::sample>& ring, ru_imu_sample* out, int max_samples)
+{
+    imu::sample chunk[64];
+    int n = 0;
+    size_t got;
+
+    while (n < max_samples && (got = ring.pop_batch(chunk, std::min<size_t>(64, max_samples - n))) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            ru_imu_sample& o = out[n + i];
+            o.timestamp = chunk[i].timestamp;
+            for (int k = 0; k < 3; k++) {
+                o.gyro[k] = chunk[i].gyro[k];
+                o.accel[k] = chunk[i].accel[k];
+                o.mag[k] = chunk[i].mag[k];
+            }
+            o.temperature = chunk[i].temperature;
+        }
+        n += (int)got;
+    }
+    return n;
+}
+
+// the current reader's turn: what is buffered, else waits up to the deadline for the first sample
+static int
+read_samples(ru_device* dev, spsc_ring<imu::sample>& ring, stream_wait& w, ru_imu_sample* out, int max_samples, int timeout_ms,
+    std::chrono::steady_clock::time_point deadline)
+{
+    int n = pop_samples(ring, out, max_samples);
+    if (n > 0 || timeout_ms == 0) return n;
+
+    std::unique_lock<std::mutex> lock(w.lock);
+
+    while (ring.size() == 0 && dev->streaming.load()) {
+        w.consumer_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.size() > 0) break;
+
+        if (timeout_ms < 0) w.cv.wait(lock);
+        else if (w.cv.wait_until(lock, deadline) == std::cv_status::timeout) break;
+    }
+    w.consumer_waiting.store(false, std::memory_order_relaxed);
+    lock.unlock();
+
+    n = pop_samples(ring, out, max_samples);
+    return n == 0 && !dev->streaming.load() ? RU_ERR_STATE : n;
+}
+
+extern "C" {
+
+int
+ru_api_version(void)
+{
+    return RU_API_VERSION;
+}
+
+const char*
+ru_error_string(int err)
+{
+    switch (err) {
+    case RU_OK: return "ok";
+    case RU_ERR_INVALID_ARG: return "invalid argument";
+    case RU_ERR_NOT_FOUND: return "device not found";
+    case RU_ERR_IO: return "i/o error";
+    case RU_ERR_TIMEOUT: return "timeout";
+    case RU_ERR_STATE: return "wrong state";
+    case RU_ERR_TOO_SMALL: return "buffer too small";
+    default: return err >= 0 ? "ok" : "unknown error";
+    }
+}
+
+ru_device*
+ru_open(void)
+{
+    if (!hid_acquire()) return nullptr;
+
+    hid_device* imu_handle = open_interface(RU_INTERFACE_IMU);
+    hid_device* control_handle = open_interface(RU_INTERFACE_CONTROL);
+    if (imu_handle == nullptr || control_handle == nullptr) {
+        if (imu_handle != nullptr) hid_close(imu_handle);
+        if (control_handle != nullptr) hid_close(control_handle);
+        hid_release();
+        return nullptr;
+    }
+
+    ru_device* dev = new ru_device();
+    dev->imu_handle = imu_handle;
+    dev->control_handle = control_handle;
+    dev->imu.reset(new hid_transport(imu_handle));
+    dev->control.reset(new hid_transport(control_handle));
+    dev->mailbox_waiting = false;
+    dev->mailbox_full = false;
+    dev->mailbox_id = 0;
+    dev->streaming = false;
+    dev->reading = false;
+    imu::default_calibration(&dev->cal);
+    return dev;
+}
+
+void
+ru_close(ru_device* dev)
+{
+    if (dev == nullptr) return;
+
+    ru_imu_stop(dev);
+    hid_close(dev->imu_handle);
+    hid_close(dev->control_handle);
+    delete dev;
+    hid_release();
+}
+
+int
+ru_msg_id(int interface_num, const char* name)
+{
+    if (name == nullptr) return RU_ERR_INVALID_ARG;
+
+    if (interface_num == RU_INTERFACE_IMU) {
+        uint8_t id = protocol3::hexForKey(name);
+        return id == 0 ? -1 : id;
+    }
+    if (interface_num == RU_INTERFACE_CONTROL) {
+        uint16_t id = protocol::hexForKey(name);
+        return id == 0 ? -1 : id;
+    }
+    return RU_ERR_INVALID_ARG;
+}
+
+int
+ru_send(ru_device* dev, int interface_num, uint16_t msg_id, const uint8_t* payload, int payload_size,
+    uint8_t* reply, int reply_capacity, int timeout_ms)
+{
+    if (dev == nullptr || (payload == nullptr && payload_size > 0)) return RU_ERR_INVALID_ARG;
+    if (interface_num != RU_INTERFACE_CONTROL && interface_num != RU_INTERFACE_IMU) return RU_ERR_INVALID_ARG;
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    uint8_t read_buf[1024];
+
+    if (interface_num == RU_INTERFACE_CONTROL) {
+        std::lock_guard<std::mutex> lock(dev->control_lock);
+
+        int err = write_frame(dev->control.get(), interface_num, msg_id, payload, payload_size);
+        if (err != RU_OK) return err;
+
+        protocol::parsed_rsp rsp;
+        while (true) {
+            int res = dev->control->read(read_buf, sizeof(read_buf), remaining_ms(deadline));
+            if (res < 0) return RU_ERR_IO;
+            if (res == 0) return RU_ERR_TIMEOUT;
+
+            protocol::parse_rsp(read_buf, res, &rsp);
+            if (rsp.valid && rsp.msgId == msg_id) return copy_reply(rsp.payload, rsp.payload_size, reply, reply_capacity);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(dev->imu_lock);
+
+    if (dev->reading.load()) {
+        std::unique_lock<std::mutex> mailbox(dev->mailbox_lock);
+        dev->mailbox_waiting = true;
+        dev->mailbox_full = false;
+        dev->mailbox_id = (uint8_t)msg_id;
+        mailbox.unlock();
+
+        int err = write_frame(dev->imu.get(), interface_num, msg_id, payload, payload_size);
+
+        mailbox.lock();
+        if (err == RU_OK && !dev->mailbox_cv.wait_until(mailbox, deadline, [dev] { return dev->mailbox_full; })) err = RU_ERR_TIMEOUT;
+        dev->mailbox_waiting = false;
+        if (err != RU_OK) return err;
+
+        return copy_reply(dev->mailbox_rsp.payload, dev->mailbox_rsp.payload_size, reply, reply_capacity);
+    }
+
+    int err = write_frame(dev->imu.get(), interface_num, msg_id, payload, payload_size);
+    if (err != RU_OK) return err;
+
+    protocol3::parsed_rsp rsp;
+    while (true) {
+        int res = dev->imu->read(read_buf, sizeof(read_buf), remaining_ms(deadline));
+        if (res < 0) return RU_ERR_IO;
+        if (res == 0) return RU_ERR_TIMEOUT;
+        if (imu::is_sample(read_buf, res)) continue;
+
+        protocol3::parse_rsp(read_buf, res, &rsp);
+        if (rsp.valid && rsp.msgId == msg_id) return copy_reply(rsp.payload, rsp.payload_size, reply, reply_capacity);
+    }
+}
+
+int
+ru_imu_start(ru_device* dev, uint32_t ring_capacity)
+{
+    if (dev == nullptr || ring_capacity == 0) return RU_ERR_INVALID_ARG;
+
+    // claimed before the calibration download, two starts would interleave its segments
+    bool idle = false;
+    if (!dev->streaming.compare_exchange_strong(idle, true)) return RU_ERR_STATE;
+
+    // calibration first, the reader thread applies it to every sample
+    uint8_t reply[256];
+    imu::default_calibration(&dev->cal);
+    protocol_codec::cal_data_length length;
+    int res = ru_send(dev, RU_INTERFACE_IMU, protocol3::GET_CAL_DATA_LENGTH, nullptr, 0, reply, sizeof(reply), 1000);
+    if (res > 0 && protocol_codec::decode(reply, res, &length)) {
+        uint32_t remaining = length.length;
+        std::string json;
+        while (remaining > 0) {
+            res = ru_send(dev, RU_INTERFACE_IMU, protocol3::CAL_DATA_GET_NEXT_SEGMENT, nullptr, 0, reply, sizeof(reply), 1000);
+            if (res <= 0 || (uint32_t)res > remaining) break;
+            json.append((const char*)reply, res);
+            remaining -= res;
+        }
+        imu::load_calibration(json.data(), json.size(), &dev->cal);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(dev->stream_lock);
+    dev->decimator.reset(new imu_decimator((float)imu::NOMINAL_RATE_HZ));
+    dev->decimator->add_stream((float)imu::NOMINAL_RATE_HZ, ring_capacity);
+    for (size_t i = 0; i < dev->stream_rates.size(); i++) {
+        dev->decimator->add_stream(dev->stream_rates[i], dev->stream_capacities[i]);
+    }
+    dev->waits.reset(new stream_wait[dev->decimator->streams()]);
+
+    if (write_imu_stream(dev->imu.get(), true) != RU_OK) {
+        dev->decimator.reset();
+        dev->waits.reset();
+        dev->streaming = false;
+        return RU_ERR_IO;
+    }
+
+    lock.unlock();
+
+    // from here on ru_send hands IMU replies over through the mailbox
+    std::lock_guard<std::mutex> imu(dev->imu_lock);
+    dev->reader = std::thread(read_imu_stream, dev);
+    dev->reading = true;
+    return RU_OK;
+}
+
+int
+ru_imu_stop(ru_device* dev)
+{
+    if (dev == nullptr) return RU_ERR_INVALID_ARG;
+
+    // an ru_send in flight finishes first, later ones read the interface directly again
+    std::lock_guard<std::mutex> imu(dev->imu_lock);
+    bool running = true;
+    if (!dev->reading.compare_exchange_strong(running, false)) return dev->streaming.load() ? RU_ERR_STATE : RU_OK;
+    dev->streaming = false;
+
+    // blocked readers see streaming drop and leave, then nobody holds the rings
+    for (int i = 0; i < dev->decimator->streams(); i++) {
+        std::lock_guard<std::mutex> lock(dev->waits[i].lock);
+        dev->waits[i].cv.notify_all();
+        dev->waits[i].turn.notify_all();
+    }
+    {
+        std::unique_lock<std::shared_mutex> lock(dev->stream_lock);
+        dev->reader.join();
+        dev->decimator.reset();
+        dev->waits.reset();
+    }
+
+    return write_imu_stream(dev->imu.get(), false);
+}
+
+int
+ru_imu_add_stream(ru_device* dev, float rate_hz, uint32_t ring_capacity)
+{
+    if (dev == nullptr || rate_hz <= 0 || ring_capacity == 0) return RU_ERR_INVALID_ARG;
+    if (dev->streaming.load()) return RU_ERR_STATE;
+
+    dev->stream_rates.push_back(rate_hz);
+    dev->stream_capacities.push_back(ring_capacity);
+    return (int)dev->stream_rates.size();
+}
+
+int
+ru_imu_read_stream(ru_device* dev, int stream, ru_imu_sample* out, int max_samples, int timeout_ms)
+{
+    if (dev == nullptr || out == nullptr || max_samples <= 0 || stream < 0) return RU_ERR_INVALID_ARG;
+
+    std::shared_lock<std::shared_mutex> streams(dev->stream_lock);
+    if (!dev->decimator || !dev->streaming.load()) return RU_ERR_STATE;
+    if (stream >= dev->decimator->streams()) return RU_ERR_INVALID_ARG;
+
+    stream_wait& w = dev->waits[stream];
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    {
+        std::unique_lock<std::mutex> lock(w.lock);
+        while (w.reader_busy) {
+            if (!dev->streaming.load()) return RU_ERR_STATE;
+            if (timeout_ms == 0) return 0;
+            if (timeout_ms < 0) w.turn.wait(lock);
+            else if (w.turn.wait_until(lock, deadline) == std::cv_status::timeout && w.reader_busy) return 0;
+        }
+        w.reader_busy = true;
+    }
+
+    int n = read_samples(dev, dev->decimator->ring(stream), w, out, max_samples, timeout_ms, deadline);
+
+    {
+        std::lock_guard<std::mutex> lock(w.lock);
+        w.reader_busy = false;
+    }
+    w.turn.notify_one();
+    return n;
+}
+
+int
+ru_imu_read(ru_device* dev, ru_imu_sample* out, int max_samples, int timeout_ms)
+{
+    return ru_imu_read_stream(dev, 0, out, max_samples, timeout_ms);
+}
+
+uint64_t
+ru_imu_stream_dropped(ru_device* dev, int stream)
+{
+    if (dev == nullptr || stream < 0) return 0;
+
+    std::shared_lock<std::shared_mutex> streams(dev->stream_lock);
+    if (!dev->decimator || stream >= dev->decimator->streams()) return 0;
+    return dev->decimator->dropped(stream);
+}
+
+uint64_t
+ru_imu_dropped(ru_device* dev)
+{
+    return ru_imu_stream_dropped(dev, 0);
+}
+
+}
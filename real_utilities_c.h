@@ -0,0 +1,107 @@
+#pragma once
+/*
+ * Stable C interface to the glasses, built as Real_Utilities_C.dll / libreal_utilities.so.
+ *
+ * Only plain C types cross the boundary. Structs are append-only: new fields go at the
+ * end and RU_API_VERSION is bumped, existing fields never move. IMU samples are decoded
+ * and calibrated inside the library and handed out in batches into caller-owned arrays,
+ * so bindings pay one call per batch rather than per sample.
+ *
+ * Devices are thread safe. ru_imu_start claims the stream before it downloads the
+ * calibration, so a concurrent second start gets RU_ERR_STATE, as does ru_imu_stop
+ * until that start has finished. Readers of one stream take turns; give each stream
+ * its own thread to read them in parallel.
+ */
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifdef REAL_UTILITIES_C_EXPORTS
+#define RU_API __declspec(dllexport)
+#else
+#define RU_API __declspec(dllimport)
+#endif
+#else
+#define RU_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RU_API_VERSION 2
+
+#define RU_OK 0
+#define RU_ERR_INVALID_ARG -1
+#define RU_ERR_NOT_FOUND -2
+#define RU_ERR_IO -3
+#define RU_ERR_TIMEOUT -4
+#define RU_ERR_STATE -5
+#define RU_ERR_TOO_SMALL -6
+
+#define RU_INTERFACE_CONTROL 4
+#define RU_INTERFACE_IMU 3
+
+typedef struct ru_device ru_device;
+
+/*
+ * Frozen: callers index arrays of it, so unlike the other structs it can never grow.
+ * 48 bytes on every platform; richer samples would come as a new struct and new read calls.
+ */
+typedef struct {
+    uint64_t timestamp;      /* device clock, ns */
+    float gyro[3];           /* deg/s */
+    float accel[3];          /* g */
+    float mag[3];            /* gauss */
+    float temperature;       /* deg C */
+} ru_imu_sample;
+
+RU_API int ru_api_version(void);
+RU_API const char* ru_error_string(int err);
+
+/* opens the first connected glasses, NULL if none; hidapi is set up by the first open and torn down by the last close */
+RU_API ru_device* ru_open(void);
+RU_API void ru_close(ru_device* dev);
+
+/* message id for a name from the control (4) or IMU (3) table, -1 if unknown */
+RU_API int ru_msg_id(int interface_num, const char* name);
+
+/*
+ * Sends a command and waits for the reply with the same id. The reply payload is copied
+ * into reply (status byte first on the control interface); returns its size or an RU_ERR_*.
+ * Safe to call while the IMU stream is running.
+ */
+RU_API int ru_send(ru_device* dev, int interface_num, uint16_t msg_id, const uint8_t* payload, int payload_size,
+    uint8_t* reply, int reply_capacity, int timeout_ms);
+
+/* downloads the calibration, starts the stream and a reader thread feeding a ring of ring_capacity samples */
+RU_API int ru_imu_start(ru_device* dev, uint32_t ring_capacity);
+/* wakes blocked readers, which return RU_ERR_STATE, and frees the rings with anything still in them */
+RU_API int ru_imu_stop(ru_device* dev);
+
+/*
+ * Copies up to max_samples buffered samples into out. Waits up to timeout_ms for the first
+ * one (0 = don't wait, < 0 = forever). Returns the number copied or an RU_ERR_*, RU_ERR_STATE
+ * when the stream is not running or is stopped while waiting.
+ */
+RU_API int ru_imu_read(ru_device* dev, ru_imu_sample* out, int max_samples, int timeout_ms);
+
+/* samples dropped because the ring was full */
+RU_API uint64_t ru_imu_dropped(ru_device* dev);
+
+/*
+ * Since version 2. Adds a low-pass filtered, decimated copy of the stream at roughly rate_hz
+ * (an integer fraction of the IMU rate). Call before ru_imu_start; returns the stream index
+ * (ru_imu_read is stream 0, the full rate) or an RU_ERR_*. Filtered samples lag the input
+ * by about 8 output periods and carry the timestamp of the input they describe.
+ */
+RU_API int ru_imu_add_stream(ru_device* dev, float rate_hz, uint32_t ring_capacity);
+/*
+ * As ru_imu_read for one stream, a reader is only woken when its own stream has data.
+ * A second reader of the same stream waits for the first within its own timeout_ms.
+ */
+RU_API int ru_imu_read_stream(ru_device* dev, int stream, ru_imu_sample* out, int max_samples, int timeout_ms);
+RU_API uint64_t ru_imu_stream_dropped(ru_device* dev, int stream);
+
+#ifdef __cplusplus
+}
+#endif
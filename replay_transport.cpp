@@ -0,0 +1,292 @@
+#include "replay_transport.h"
+#include "capture_transport.h"
+
+#include <algorithm>
+#include <string.h>
+
+const int INDEX_ENTRY_SIZE = /*NS*/8 + /*OFFSET*/8;
+
+static uint64_t
+get_le(const uint8_t* buf, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+        value = (value << 8) | buf[i];
+    return value;
+}
+
+// long is 32-bit on Windows, hour-long captures grow past 2 GB
+static int
+seek64(FILE* f, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, origin);
+#else
+    return fseeko(f, (off_t)offset, origin);
+#endif
+}
+
+static uint64_t
+tell64(FILE* f)
+{
+#ifdef _WIN32
+    return (uint64_t)_ftelli64(f);
+#else
+    return (uint64_t)ftello(f);
+#endif
+}
+
+replay_transport::replay_transport() :
+    file(nullptr), interface_num(-1), speed(1.0), index_file(nullptr), index_entries(0), current(0), current_ready(false), load_next(0), load_offset(0), epoch(0),
+    loaded_all(false), stopping(false), origin_ns(0), pending_len(0), pending_ns(0), has_pending(false), position_ns(0), at_end(false)
+{
+    for (chunk& c : chunks) {
+        c.data.reset(new uint8_t[CHUNK_SIZE]);
+        c.size = 0;
+        c.used = 0;
+        c.filled = false;
+        c.eof = false;
+    }
+}
+
+replay_transport::~replay_transport()
+{
+    close();
+}
+
+bool
+replay_transport::open(const std::string& path, double speed_in, std::chrono::steady_clock::time_point origin_in)
+{
+    close();
+
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+
+    uint8_t header[capture_transport::HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, capture_transport::MAGIC, sizeof(capture_transport::MAGIC)) != 0) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    interface_num = (int)get_le(&header[8], 4);
+
+    // an entry per 64 reads is close to 1 MB an hour at 1 kHz, so it stays on disk and
+    // seek() searches it there; without one seek() scans from the start
+    index_file = fopen((path + ".idx").c_str(), "rb");
+    index_entries = 0;
+    if (index_file != nullptr && seek64(index_file, 0, SEEK_END) == 0) index_entries = tell64(index_file) / INDEX_ENTRY_SIZE;
+
+    speed = speed_in;
+    origin = origin_in;
+    origin_ns = 0;
+    has_pending = false;
+    position_ns = 0;
+    at_end = false;
+    stopping = false;
+
+    restart_at(capture_transport::HEADER_SIZE);
+    loader = std::thread(&replay_transport::load_loop, this);
+    return true;
+}
+
+void
+replay_transport::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        cv.notify_all();
+    }
+    if (loader.joinable()) loader.join();
+    if (file != nullptr) fclose(file);
+    if (index_file != nullptr) fclose(index_file);
+    file = nullptr;
+    index_file = nullptr;
+    index_entries = 0;
+}
+
+void
+replay_transport::restart_at(uint64_t offset)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    epoch++;
+    for (chunk& c : chunks) {
+        c.filled = false;
+        c.used = 0;
+    }
+    current = 0;
+    current_ready = false;
+    load_next = 0;
+    load_offset = offset;
+    loaded_all = false;
+    cv.notify_all();
+}
+
+void
+replay_transport::load_loop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        cv.wait(guard, [this] { return stopping || (!loaded_all && !chunks[load_next].filled); });
+        if (stopping) return;
+
+        // the reader never touches an unfilled chunk, so fill it without holding the lock
+        int target = load_next;
+        uint64_t offset = load_offset;
+        uint64_t loading_epoch = epoch;
+        guard.unlock();
+
+        size_t n = 0;
+        if (seek64(file, offset, SEEK_SET) == 0) n = fread(chunks[target].data.get(), 1, CHUNK_SIZE, file);
+
+        guard.lock();
+        if (epoch != loading_epoch) continue;
+
+        chunk& c = chunks[target];
+        c.size = n;
+        c.used = 0;
+        c.eof = n < CHUNK_SIZE;
+        c.filled = true;
+        load_offset += n;
+        load_next ^= 1;
+        loaded_all = c.eof;
+        cv.notify_all();
+    }
+}
+
+bool
+replay_transport::take(uint8_t* out, size_t n)
+{
+    while (n > 0) {
+        chunk& c = chunks[current];
+        if (!current_ready) {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [this, &c] { return stopping || c.filled; });
+            if (stopping) return false;
+            current_ready = true;
+        }
+
+        size_t available = c.size - c.used;
+        if (available == 0) {
+            if (c.eof) return false;
+
+            // hand the drained chunk back to the loader and move to the other one
+            std::lock_guard<std::mutex> guard(lock);
+            c.filled = false;
+            current ^= 1;
+            current_ready = false;
+            cv.notify_all();
+            continue;
+        }
+
+        size_t step = std::min(available, n);
+        memcpy(out, c.data.get() + c.used, step);
+        c.used += step;
+        out += step;
+        n -= step;
+    }
+    return true;
+}
+
+bool
+replay_transport::next_read()
+{
+    uint8_t header[capture_transport::RECORD_HEADER_SIZE];
+
+    while (true) {
+        if (!take(header, sizeof(header))) return false;
+
+        uint64_t ns = get_le(&header[0], 8);
+        int dir = header[8];
+        int len = (int)get_le(&header[10], 2);
+        if (len > (int)sizeof(pending) || !take(pending, len)) return false;
+
+        if (dir != capture_transport::DIR_READ) continue;
+
+        pending_len = len;
+        pending_ns = ns;
+        has_pending = true;
+        return true;
+    }
+}
+
+bool
+replay_transport::index_entry(uint64_t i, uint64_t* ns, uint64_t* offset)
+{
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    if (seek64(index_file, i * INDEX_ENTRY_SIZE, SEEK_SET) != 0 || fread(entry, 1, sizeof(entry), index_file) != sizeof(entry)) return false;
+    *ns = get_le(&entry[0], 8);
+    *offset = get_le(&entry[8], 8);
+    return true;
+}
+
+bool
+replay_transport::seek(uint64_t ns, std::chrono::steady_clock::time_point origin_in)
+{
+    if (file == nullptr) return false;
+
+    // last index entry at or before ns, then walk forward from there
+    uint64_t offset = capture_transport::HEADER_SIZE;
+    uint64_t lo = 0, hi = index_entries;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        uint64_t entry_ns = 0, entry_offset = 0;
+        if (!index_entry(mid, &entry_ns, &entry_offset)) {
+            lo = 0; // unreadable index, scan from the start
+            break;
+        }
+        if (entry_ns <= ns) lo = mid + 1;
+        else hi = mid;
+    }
+    uint64_t entry_ns = 0;
+    if (lo > 0) index_entry(lo - 1, &entry_ns, &offset);
+
+    restart_at(offset);
+    has_pending = false;
+    at_end = false;
+    origin = origin_in;
+    origin_ns = ns;
+
+    while (next_read()) {
+        if (pending_ns >= ns) return true;
+    }
+    has_pending = false;
+    at_end = true;
+    return false;
+}
+
+int
+replay_transport::write(const uint8_t*, size_t length)
+{
+    return file == nullptr ? -1 : (int)length;
+}
+
+int
+replay_transport::read(uint8_t* data, size_t length, int timeout_ms)
+{
+    if (!has_pending && !next_read()) {
+        at_end = true;
+        return -1;
+    }
+
+    if (speed > 0) {
+        double delay_ns = (double)(int64_t)(pending_ns - origin_ns) / speed;
+        std::chrono::steady_clock::time_point due = origin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::nano>(delay_ns));
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        if (now < due) {
+            if (timeout_ms >= 0 && now + std::chrono::milliseconds(timeout_ms) < due) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+                return 0;
+            }
+            std::this_thread::sleep_until(due);
+        }
+    }
+
+    int n = std::min((int)length, pending_len);
+    memcpy(data, pending, n);
+    has_pending = false;
+    position_ns = pending_ns;
+    return n;
+}
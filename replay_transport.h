@@ -0,0 +1,86 @@
+#pragma once
+#include "transport.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+
+// Plays a capture_transport recording back through the transport interface. The file is
+// streamed through two fixed size buffers, a loader thread filling one while reads drain
+// the other, and seek() binary searches <path>.idx on disk instead of loading it, so memory
+// stays at the two buffers however long the session is.
+//
+// read() hands out the recorded reports in order, at the recorded pace divided by speed
+// (0 = as fast as possible), and returns -1 once the recording is exhausted. Writes are
+// accepted and dropped: the replies the stack sees are the ones that were recorded.
+class replay_transport : public transport
+{
+public:
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    replay_transport();
+    ~replay_transport();
+
+    // origin is shared by the replays of one session so their schedules line up
+    bool open(const std::string& path, double speed, std::chrono::steady_clock::time_point origin);
+    void close();
+
+    // positions on the first report at or after ns (capture time) and plays it at origin
+    bool seek(uint64_t ns, std::chrono::steady_clock::time_point origin);
+
+    int write(const uint8_t* data, size_t length) override;
+    int read(uint8_t* data, size_t length, int timeout_ms) override;
+
+    int interface_number() const { return interface_num; }
+    // capture time of the last report handed out
+    uint64_t position() const { return position_ns; }
+    bool finished() const { return at_end; }
+
+private:
+    struct chunk {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+        size_t used;
+        bool filled;
+        bool eof;
+    };
+
+    void load_loop();
+    void restart_at(uint64_t offset);
+    bool take(uint8_t* out, size_t n);
+    // next read record into pending, writes are skipped
+    bool next_read();
+    bool index_entry(uint64_t i, uint64_t* ns, uint64_t* offset);
+
+    FILE* file;
+    int interface_num;
+    double speed;
+    FILE* index_file;            // (ns, offset) pairs from <path>.idx, nullptr if there is none
+    uint64_t index_entries;
+
+    std::thread loader;
+    std::mutex lock;
+    std::condition_variable cv;
+    chunk chunks[2];
+    int current;                 // chunk reads are draining
+    bool current_ready;          // reader has seen current filled, only it touches it now
+    int load_next;               // chunk the loader fills next
+    uint64_t load_offset;
+    uint64_t epoch;              // bumped by seeks, stale loads are thrown away
+    bool loaded_all;
+    bool stopping;
+
+    std::chrono::steady_clock::time_point origin;
+    uint64_t origin_ns;
+    uint8_t pending[1024];
+    int pending_len;
+    uint64_t pending_ns;
+    bool has_pending;
+    uint64_t position_ns;
+    bool at_end;
+};
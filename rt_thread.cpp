@@ -0,0 +1,267 @@
+#include "rt_thread.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <iostream>
+#include <stdint.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <malloc.h>
+#define stack_alloc _alloca
+#else
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#define stack_alloc alloca
+#endif
+
+const size_t MAX_PREFAULT_STACK = 8 * 1024 * 1024;
+// left untouched below the prefault for the frames the thread calls into afterwards
+const size_t STACK_MARGIN = 64 * 1024;
+
+void
+rt_thread::default_config(config* cfg)
+{
+    cfg->cpu = -1;
+    cfg->policy = POLICY_DEFAULT;
+    cfg->priority = 0;
+    cfg->prefault_stack = 0;
+}
+
+static size_t
+parse_size(const std::string& value)
+{
+    char* end = nullptr;
+    size_t n = strtoul(value.c_str(), &end, 10);
+    if (*end == 'k' || *end == 'K') n *= 1024;
+    else if (*end == 'm' || *end == 'M') n *= 1024 * 1024;
+    return n;
+}
+
+// the whole of value as a decimal int, false on anything else
+static bool
+parse_int(const std::string& value, int* out)
+{
+    char* end = nullptr;
+    errno = 0;
+    long n = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || errno == ERANGE || n < INT_MIN || n > INT_MAX) return false;
+    *out = (int)n;
+    return true;
+}
+
+// fifo and rr share a range: 1-99 on Linux, Windows maps both to time critical
+static void
+priority_range(int* low, int* high)
+{
+#ifdef _WIN32
+    *low = 1;
+    *high = 99;
+#else
+    *low = sched_get_priority_min(SCHED_FIFO);
+    *high = sched_get_priority_max(SCHED_FIFO);
+#endif
+}
+
+bool
+rt_thread::parse(const std::string& spec, config* cfg, std::string* error)
+{
+    std::istringstream in(spec);
+    std::string item;
+    bool has_priority = false;
+
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            *error = "expected key=value, got '" + item + "'";
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+
+        if (key == "cpu") {
+            if (!parse_int(value, &cfg->cpu)) {
+                *error = "cpu expects a number, got '" + value + "'";
+                return false;
+            }
+            unsigned cpus = std::thread::hardware_concurrency();
+            if (cfg->cpu < 0 || (cpus > 0 && (unsigned)cfg->cpu >= cpus)) {
+                *error = "cpu " + value + " out of range, this machine has " + std::to_string(cpus);
+                return false;
+            }
+        }
+        else if (key == "prio") {
+            if (!parse_int(value, &cfg->priority)) {
+                *error = "prio expects a number, got '" + value + "'";
+                return false;
+            }
+            has_priority = true;
+        }
+        else if (key == "stack") cfg->prefault_stack = parse_size(value);
+        else if (key == "policy") {
+            if (value == "fifo") cfg->policy = POLICY_FIFO;
+            else if (value == "rr") cfg->policy = POLICY_RR;
+            else if (value == "other") cfg->policy = POLICY_OTHER;
+            else {
+                *error = "unknown policy '" + value + "', expected fifo, rr or other";
+                return false;
+            }
+        }
+        else {
+            *error = "unknown key '" + key + "'";
+            return false;
+        }
+    }
+
+    // checked once the whole spec is read, policy may come after prio
+    if (has_priority || cfg->policy == POLICY_FIFO || cfg->policy == POLICY_RR) {
+        int low, high;
+        priority_range(&low, &high);
+        if (cfg->priority < low || cfg->priority > high) {
+            *error = "prio " + std::to_string(cfg->priority) + " out of range, fifo and rr take " + std::to_string(low) + "-" + std::to_string(high);
+            return false;
+        }
+    }
+    if (cfg->prefault_stack > MAX_PREFAULT_STACK) {
+        *error = "stack prefault larger than 8M";
+        return false;
+    }
+    return true;
+}
+
+std::string
+rt_thread::describe(const config& cfg)
+{
+    static const char* policies[] = { "default", "other", "fifo", "rr" };
+    std::ostringstream out;
+
+    out << "cpu " << (cfg.cpu < 0 ? std::string("any") : std::to_string(cfg.cpu))
+        << ", policy " << policies[cfg.policy];
+    if (cfg.policy == POLICY_FIFO || cfg.policy == POLICY_RR) out << " " << cfg.priority;
+    if (cfg.prefault_stack > 0) out << ", stack " << cfg.prefault_stack / 1024 << "k";
+    return out.str();
+}
+
+// stack left below the caller's frame, 0 if the platform won't say
+static size_t
+stack_remaining()
+{
+    char here;
+    uintptr_t top = (uintptr_t)&here;
+    uintptr_t low = 0;
+
+#ifdef _WIN32
+    ULONG_PTR limit_low = 0, limit_high = 0;
+    GetCurrentThreadStackLimits(&limit_low, &limit_high);
+    low = (uintptr_t)limit_low;
+#else
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) return 0;
+    void* addr = nullptr;
+    size_t size = 0;
+    if (pthread_attr_getstack(&attr, &addr, &size) == 0) low = (uintptr_t)addr;
+    pthread_attr_destroy(&attr);
+#endif
+
+    return low != 0 && top > low ? top - low : 0;
+}
+
+// touch the pages now so the first deep call on the hot path doesn't fault
+static void
+prefault_stack(size_t bytes)
+{
+    volatile char* stack = static_cast<volatile char*>(stack_alloc(bytes));
+    for (size_t i = 0; i < bytes; i += 4096)
+        stack[i] = 0;
+}
+
+bool
+rt_thread::apply(const config& cfg, const char* thread_name)
+{
+    bool ok = true;
+
+#ifdef _WIN32
+    // an affinity mask only reaches the 64 (32 on x86) processors of the thread's group
+    if (cfg.cpu >= (int)(sizeof(DWORD_PTR) * 8)) {
+        std::cerr << thread_name << ": cpu " << cfg.cpu << " is outside the affinity mask" << std::endl;
+        ok = false;
+    }
+    else if (cfg.cpu >= 0 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cfg.cpu) == 0) {
+        std::cerr << thread_name << ": unable to set affinity to cpu " << cfg.cpu << std::endl;
+        ok = false;
+    }
+
+    // no SCHED_FIFO on Windows, fifo/rr map to time critical priority
+    int priority = THREAD_PRIORITY_NORMAL;
+    if (cfg.policy == POLICY_FIFO || cfg.policy == POLICY_RR) priority = THREAD_PRIORITY_TIME_CRITICAL;
+    if (cfg.policy != POLICY_DEFAULT && !SetThreadPriority(GetCurrentThread(), priority)) {
+        std::cerr << thread_name << ": unable to set thread priority" << std::endl;
+        ok = false;
+    }
+#else
+    if (cfg.cpu >= CPU_SETSIZE) {
+        std::cerr << thread_name << ": cpu " << cfg.cpu << " is outside the affinity mask" << std::endl;
+        ok = false;
+    }
+    else if (cfg.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cfg.cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            std::cerr << thread_name << ": unable to set affinity to cpu " << cfg.cpu << ": " << strerror(err) << std::endl;
+            ok = false;
+        }
+    }
+
+    if (cfg.policy != POLICY_DEFAULT) {
+        int policy = cfg.policy == POLICY_FIFO ? SCHED_FIFO : cfg.policy == POLICY_RR ? SCHED_RR : SCHED_OTHER;
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = policy == SCHED_OTHER ? 0 : cfg.priority;
+
+        int err = pthread_setschedparam(pthread_self(), policy, &param);
+        if (err != 0) {
+            std::cerr << thread_name << ": unable to set scheduling policy: " << strerror(err)
+                << (err == EPERM ? " (needs CAP_SYS_NICE or an rtprio limit)" : "") << std::endl;
+            ok = false;
+        }
+    }
+#endif
+
+    if (cfg.prefault_stack > 0) {
+        // the thread is already some way into its stack, touching all of it would hit the guard page
+        size_t bytes = cfg.prefault_stack;
+        size_t remaining = stack_remaining();
+        size_t limit = remaining > STACK_MARGIN ? remaining - STACK_MARGIN : 0;
+        if (remaining > 0 && bytes > limit) {
+            bytes = limit;
+            std::cerr << thread_name << ": stack prefault clamped to " << bytes / 1024 << "k of the " << remaining / 1024 << "k left" << std::endl;
+            ok = false;
+        }
+        if (bytes > 0) prefault_stack(bytes);
+    }
+
+    return ok;
+}
+
+bool
+rt_thread::lock_memory()
+{
+#ifdef _WIN32
+    std::cerr << "memory locking is not supported on Windows" << std::endl;
+    return false;
+#else
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "unable to lock memory: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+#include <string>
+
+// Scheduling knobs for the threads on the hid_read -> consumer path. A config is
+// parsed from "cpu=2,policy=fifo,prio=80,stack=256k" and applied by the thread itself.
+class rt_thread
+{
+public:
+    enum policy_t {
+        POLICY_DEFAULT,   // leave the thread as created
+        POLICY_OTHER,
+        POLICY_FIFO,
+        POLICY_RR
+    };
+
+    typedef struct {
+        int cpu;                 // -1 = no affinity
+        policy_t policy;
+        int priority;            // 1-99 for fifo/rr
+        size_t prefault_stack;   // bytes of stack to touch up front, 0 = none
+    } config;
+
+    static void default_config(config* cfg);
+    static bool parse(const std::string& spec, config* cfg, std::string* error);
+    static std::string describe(const config& cfg);
+
+    // applies cfg to the calling thread, reports each setting it could not apply
+    static bool apply(const config& cfg, const char* thread_name);
+    // mlockall(MCL_CURRENT | MCL_FUTURE) so page faults stay off the I/O path
+    static bool lock_memory();
+};
@@ -0,0 +1,153 @@
+#include "script.h"
+#include "protocol.h"
+#include "protocol3.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+
+const uint32_t DEFAULT_TIMEOUT_MS = 1000;
+
+static bool
+resolve_msgId(script::target_t target, const std::string& token, uint16_t* out)
+{
+    if (token.size() > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'X')) {
+        char* end = nullptr;
+        unsigned long value = strtoul(token.c_str() + 2, &end, 16);
+        if (*end != '\0' || value > (target == script::TARGET_IMU ? 0xffUL : 0xffffUL)) return false;
+        *out = (uint16_t)value;
+        return true;
+    }
+
+    *out = target == script::TARGET_IMU ? protocol3::hexForKey(token) : protocol::hexForKey(token);
+    return *out != 0;
+}
+
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool
+append_hex(const std::string& token, std::vector<uint8_t>* payload)
+{
+    if (token.size() % 2 != 0) return false;
+
+    for (size_t i = 0; i < token.size(); i += 2) {
+        int hi = hex_value(token[i]);
+        int lo = hex_value(token[i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        payload->push_back((uint8_t)(hi << 4 | lo));
+    }
+    return true;
+}
+
+bool
+script::parse_line(const std::string& line, int line_no, step* out, std::string* error)
+{
+    std::istringstream in(line.substr(0, line.find('#')));
+    std::string token;
+
+    if (!(in >> token)) return false; // blank line
+
+    memset(out->frame, 0, sizeof(out->frame));
+    out->line = line_no;
+    out->delay_ms = 0;
+    out->expect = false;
+    out->expect_msgId = 0;
+    out->timeout_ms = DEFAULT_TIMEOUT_MS;
+    out->repeat = 1;
+
+    if (token == "control") out->target = TARGET_CONTROL;
+    else if (token == "imu") out->target = TARGET_IMU;
+    else {
+        *error = "unknown target '" + token + "', expected control or imu";
+        return false;
+    }
+
+    if (!(in >> out->name) || !resolve_msgId(out->target, out->name, &out->msgId)) {
+        *error = "unknown message '" + out->name + "'";
+        return false;
+    }
+
+    std::vector<uint8_t> payload;
+
+    while (in >> token) {
+        size_t eq = token.find('=');
+        std::string key = token.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : token.substr(eq + 1);
+
+        if (key == "delay") out->delay_ms = strtoul(value.c_str(), nullptr, 10);
+        else if (key == "timeout") out->timeout_ms = strtoul(value.c_str(), nullptr, 10);
+        else if (key == "repeat") out->repeat = strtoul(value.c_str(), nullptr, 10);
+        else if (key == "expect") {
+            out->expect = true;
+            out->expect_msgId = out->msgId;
+            if (!value.empty() && !resolve_msgId(out->target, value, &out->expect_msgId)) {
+                *error = "unknown message '" + value + "'";
+                return false;
+            }
+        }
+        else if (!append_hex(token, &payload)) {
+            *error = "bad token '" + token + "'";
+            return false;
+        }
+    }
+
+    if (out->target == TARGET_IMU)
+        out->frame_len = protocol3::cmd_build((uint8_t)out->msgId, payload.data(), (int)payload.size(), &out->frame[1], sizeof(out->frame) - 1);
+    else
+        out->frame_len = protocol::cmd_build(out->msgId, payload.data(), (int)payload.size(), &out->frame[1], sizeof(out->frame) - 1);
+
+    if (out->frame_len == 0) {
+        *error = "payload too large";
+        return false;
+    }
+    out->frame_len += 1; // leading report id
+
+    return true;
+}
+
+bool
+script::parse_text(const std::string& text, char separator, std::vector<step>* out)
+{
+    std::istringstream in(text);
+    std::string line;
+    int line_no = 0;
+    bool ok = true;
+
+    while (std::getline(in, line, separator)) {
+        line_no++;
+
+        step s;
+        std::string error;
+        if (parse_line(line, line_no, &s, &error)) {
+            out->push_back(s);
+        }
+        else if (!error.empty()) {
+            std::cerr << "script line " << std::dec << line_no << ": " << error << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool
+script::load_file(const std::string& path, std::vector<step>* out)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Unable to open script " << path << std::endl;
+        return false;
+    }
+
+    std::stringstream text;
+    text << in.rdbuf();
+    return parse_text(text.str(), '\n', out);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Batch command sequences, one step per line:
+//
+//   <control|imu> <MSG_NAME|0xID> [hex payload] [delay=ms] [expect[=MSG_NAME|0xID]] [timeout=ms] [repeat=n]
+//
+// '#' starts a comment, ';' separates steps given on the command line. Frames are
+// built when the script is loaded so executing a step is a single hid_write.
+class script
+{
+public:
+    enum target_t {
+        TARGET_CONTROL,  // interface 4, protocol
+        TARGET_IMU       // interface 3, protocol3
+    };
+
+    typedef struct {
+        target_t target;
+        std::string name;
+        uint16_t msgId;
+        uint8_t frame[1024];     // frame[0] = 0x00 report id, as hid_write expects
+        int frame_len;
+        uint32_t delay_ms;       // wait after the previous step was sent
+        bool expect;
+        uint16_t expect_msgId;
+        uint32_t timeout_ms;
+        uint32_t repeat;
+        int line;
+    } step;
+
+    static bool parse_line(const std::string& line, int line_no, step* out, std::string* error);
+    static bool parse_text(const std::string& text, char separator, std::vector<step>* out);
+    static bool load_file(const std::string& path, std::vector<step>* out);
+};
@@ -0,0 +1,276 @@
+#include "sim_device.h"
+#include "protocol.h"
+#include "protocol3.h"
+#include "protocol_codec.h"
+#include "imu.h"
+
+#include <math.h>
+#include <string.h>
+
+// report layout as decoded by imu::parse_sample
+const int TEMP_OFS = 2;
+const int TS_OFS = 4;
+const int GYRO_OFS = 12;
+const int ACCEL_OFS = 27;
+const int MAG_OFS = 42;
+const int32_t FULL_SCALE_24 = 0x7fffff;
+const int32_t FULL_SCALE_16 = 0x7fff;
+const int16_t GYRO_RANGE = 2000;     // deg/s
+const int16_t ACCEL_RANGE = 16;      // g
+const int16_t MAG_RANGE = 16;        // gauss
+
+const double PI = 3.14159265358979323846;
+const uint32_t STATIC_ID = 0x20220101;
+const char TEXT_REPLY[] = "SIM";
+const char CAL_JSON[] =
+    "{\"device_1\": {"
+    "\"accel_bias\": [0.0012, -0.0031, 0.0045], \"scale_accel\": [1.0, 1.0, 1.0], "
+    "\"gyro_bias\": [0.21, -0.13, 0.08], \"scale_gyro\": [1.0, 1.0, 1.0], "
+    "\"mag_bias\": [0.02, 0.01, -0.03], \"scale_mag\": [1.0, 1.0, 1.0]}}";
+
+static void
+put_le(uint8_t* buf, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+static void
+put_be(uint8_t* buf, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        buf[bytes - 1 - i] = (value >> (8 * i)) & 0xff;
+}
+
+sim_device::port::port(sim_device* dev, int interface_num) :
+    dev(dev), interface_num(interface_num), first(0), count(0)
+{
+}
+
+void
+sim_device::port::queue(const uint8_t* frame, int len)
+{
+    // a host that stops reading loses replies, the oldest are kept
+    if (len <= 0 || len > REPLY_SIZE || count == REPLY_SLOTS) return;
+
+    int slot = (first + count) % REPLY_SLOTS;
+    memcpy(replies[slot], frame, len);
+    reply_len[slot] = len;
+    count++;
+    cv.notify_all();
+}
+
+int
+sim_device::port::take(uint8_t* data, size_t length)
+{
+    int n = reply_len[first] < (int)length ? reply_len[first] : (int)length;
+    memcpy(data, replies[first], n);
+    first = (first + 1) % REPLY_SLOTS;
+    count--;
+    return n;
+}
+
+int
+sim_device::port::write(const uint8_t* data, size_t length)
+{
+    if (data == nullptr || length < 2) return -1;
+
+    // data[0] is the report id, the frame follows
+    std::lock_guard<std::mutex> guard(dev->lock);
+    if (interface_num == 3) dev->on_imu_command(data + 1, (int)length - 1);
+    else dev->on_control_command(data + 1, (int)length - 1);
+    return (int)length;
+}
+
+int
+sim_device::port::read(uint8_t* data, size_t length, int timeout_ms)
+{
+    typedef std::chrono::steady_clock clock;
+    clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms < 0 ? 0 : timeout_ms);
+
+    std::unique_lock<std::mutex> guard(dev->lock);
+    while (true) {
+        if (count > 0) return take(data, length);
+
+        uint64_t now = dev->now_ns();
+        uint64_t wake;
+        if (interface_num == 3) {
+            if (length >= (size_t)imu::REPORT_SIZE && dev->report_due(now)) {
+                dev->build_report(dev->next_report, data);
+                dev->next_report += dev->period_ns;
+                dev->sent.fetch_add(1, std::memory_order_relaxed);
+                return imu::REPORT_SIZE;
+            }
+            wake = dev->streaming && dev->period_ns > 0 ? dev->next_report : UINT64_MAX;
+        }
+        else {
+            if (now >= dev->next_heartbeat) {
+                uint8_t status = 0;
+                dev->next_heartbeat = now + protocol::HEARTBEAT_PERIOD_NS;
+                dev->reply_control(protocol::P_UKNOWN_HEARTBEAT, &status, 1);
+                continue;
+            }
+            wake = dev->next_heartbeat;
+        }
+
+        clock::time_point wake_at = dev->started + std::chrono::nanoseconds(wake == UINT64_MAX ? now + protocol::HEARTBEAT_PERIOD_NS : wake);
+        if (timeout_ms < 0) {
+            cv.wait_until(guard, wake_at);
+            continue;
+        }
+        if (clock::now() >= deadline) return 0;
+        cv.wait_until(guard, wake_at < deadline ? wake_at : deadline);
+    }
+}
+
+sim_device::sim_device() :
+    imu_port(this, 3), control_port(this, 4), started(std::chrono::steady_clock::now()), streaming(false), period_ns(0), next_report(0),
+    next_heartbeat(protocol::HEARTBEAT_PERIOD_NS), cal_offset(0), mode(0x01), sent(0), overflowed(0), answered(0)
+{
+}
+
+uint64_t
+sim_device::now_ns() const
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+void
+sim_device::set_imu_rate(float hz)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    period_ns = hz > 0 ? (uint64_t)(1e9 / hz) : 0;
+
+    // a new rate starts now, not with a burst of reports owed at the old one
+    uint64_t now = now_ns();
+    if (next_report < now) next_report = now;
+    imu_port.cv.notify_all();
+}
+
+bool
+sim_device::report_due(uint64_t now)
+{
+    if (!streaming || period_ns == 0 || now < next_report) return false;
+
+    uint64_t behind = (now - next_report) / period_ns;
+    if (behind >= (uint64_t)BACKLOG) {
+        uint64_t lost = behind - BACKLOG + 1;
+        overflowed.fetch_add(lost, std::memory_order_relaxed);
+        next_report += lost * period_ns;
+    }
+    return true;
+}
+
+// a slow nod on the gyro, gravity on z and a fixed field, values as the sensors would scale them
+void
+sim_device::build_report(uint64_t timestamp, uint8_t* out)
+{
+    memset(out, 0, imu::REPORT_SIZE);
+    out[0] = 0x01;
+    out[1] = 0x02;
+    put_le(&out[TEMP_OFS], (uint16_t)(int16_t)(5.0f * 132.48f), 2);
+    put_le(&out[TS_OFS], timestamp, 8);
+
+    double t = timestamp / 1e9;
+    double gyro[3] = { 30.0 * sin(2 * PI * 0.5 * t), 0.5, -0.25 };
+    double accel[3] = { 0.01, 0.02 * cos(2 * PI * 0.5 * t), 1.0 };
+    double mag[3] = { 0.2, 0.05, 0.4 };
+
+    put_le(&out[GYRO_OFS], (uint16_t)GYRO_RANGE, 2);
+    put_le(&out[GYRO_OFS + 2], (uint32_t)FULL_SCALE_24, 4);
+    put_le(&out[ACCEL_OFS], (uint16_t)ACCEL_RANGE, 2);
+    put_le(&out[ACCEL_OFS + 2], (uint32_t)FULL_SCALE_24, 4);
+    put_be(&out[MAG_OFS], (uint16_t)MAG_RANGE, 2);
+    put_be(&out[MAG_OFS + 2], (uint32_t)FULL_SCALE_16, 4);
+
+    for (int i = 0; i < 3; i++) {
+        put_le(&out[GYRO_OFS + 6 + 3 * i], (uint32_t)(int32_t)lround(gyro[i] * FULL_SCALE_24 / GYRO_RANGE), 3);
+        put_le(&out[ACCEL_OFS + 6 + 3 * i], (uint32_t)(int32_t)lround(accel[i] * FULL_SCALE_24 / ACCEL_RANGE), 3);
+        put_be(&out[MAG_OFS + 6 + 2 * i], (uint16_t)(int16_t)lround(mag[i] * FULL_SCALE_16 / MAG_RANGE), 2);
+    }
+}
+
+void
+sim_device::reply_imu(uint8_t msgId, const uint8_t* p_buf, int p_size)
+{
+    uint8_t frame[REPLY_SIZE];
+    imu_port.queue(frame, protocol3::cmd_build(msgId, p_buf, p_size, frame, sizeof(frame)));
+}
+
+void
+sim_device::reply_control(uint16_t msgId, const uint8_t* p_buf, int p_size)
+{
+    uint8_t frame[REPLY_SIZE];
+    control_port.queue(frame, protocol::cmd_build(msgId, p_buf, p_size, frame, sizeof(frame)));
+}
+
+void
+sim_device::on_imu_command(const uint8_t* frame, int len)
+{
+    protocol3::parsed_rsp cmd;
+    protocol3::parse_rsp(frame, len, &cmd);
+    if (!cmd.valid) return;
+    answered.fetch_add(1, std::memory_order_relaxed);
+
+    uint8_t p_buf[REPLY_SIZE];
+    int p_size = 0;
+
+    if (cmd.msgId == protocol3::START_IMU_DATA) {
+        protocol_codec::imu_stream_request request;
+        if (protocol_codec::decode(cmd.payload, cmd.payload_size, &request)) {
+            streaming = request.enable != 0;
+            next_report = now_ns();
+        }
+    }
+    else if (cmd.msgId == protocol3::GET_CAL_DATA_LENGTH) {
+        protocol_codec::cal_data_length length;
+        length.length = sizeof(CAL_JSON) - 1;
+        p_size = protocol_codec::encode(length, p_buf, sizeof(p_buf));
+        cal_offset = 0;
+    }
+    else if (cmd.msgId == protocol3::CAL_DATA_GET_NEXT_SEGMENT) {
+        // as much of the json as fits in one report
+        const uint32_t segment = REPLY_SIZE - /*HEAD*/1 - /*CRC*/4 - /*LEN*/2 - /*MSG_ID*/1;
+        uint32_t remaining = sizeof(CAL_JSON) - 1 - cal_offset;
+        p_size = (int)(remaining < segment ? remaining : segment);
+        memcpy(p_buf, CAL_JSON + cal_offset, p_size);
+        cal_offset += p_size;
+    }
+    else if (cmd.msgId == protocol3::GET_STATIC_ID) {
+        protocol_codec::static_id id;
+        id.id = STATIC_ID;
+        p_size = protocol_codec::encode(id, p_buf, sizeof(p_buf));
+    }
+
+    reply_imu(cmd.msgId, p_buf, p_size);
+    imu_port.cv.notify_all();
+}
+
+void
+sim_device::on_control_command(const uint8_t* frame, int len)
+{
+    protocol::parsed_rsp cmd;
+    protocol::parse_rsp(frame, len, &cmd);
+    if (!cmd.valid) return;
+    answered.fetch_add(1, std::memory_order_relaxed);
+
+    // replies lead with the status byte, 0 = ok
+    uint8_t p_buf[REPLY_SIZE] = { 0 };
+    int p_size = 1;
+
+    if (cmd.msgId == protocol::W_DISP_MODE) {
+        protocol_codec::disp_mode_request request;
+        if (protocol_codec::decode(cmd.payload, cmd.payload_size, &request)) mode = request.mode;
+    }
+    else if (cmd.msgId == protocol::R_DISP_MODE) {
+        protocol_codec::disp_mode_reply reply;
+        reply.mode = mode;
+        p_size = protocol_codec::encode(reply, p_buf, sizeof(p_buf));
+    }
+    else if (protocol::is_text(cmd.msgId)) {
+        memcpy(&p_buf[1], TEXT_REPLY, sizeof(TEXT_REPLY) - 1);
+        p_size = sizeof(TEXT_REPLY);
+    }
+
+    reply_control(cmd.msgId, p_buf, p_size);
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include "transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+
+// Stand-in for the glasses behind the transport interface, for soak runs without hardware.
+// imu() streams well formed 64 byte reports at the set rate once START_IMU_DATA enables
+// them, stamped with the simulator's clock, and answers the calibration commands; control()
+// answers every command with a framed reply and pushes a heartbeat every 5 seconds.
+//
+// Reports the host is late for queue up to BACKLOG deep, like the hid driver's buffer, and
+// the oldest are dropped past that. Nothing allocates after construction.
+class sim_device
+{
+public:
+    static const int BACKLOG = 64;
+    static const int REPLY_SLOTS = 16;
+    static const int REPLY_SIZE = 64;
+
+    sim_device();
+
+    transport* imu() { return &imu_port; }
+    transport* control() { return &control_port; }
+
+    // reports per second, 0 pauses the stream; takes effect from the next report
+    void set_imu_rate(float hz);
+
+    // report timestamps are ns since this point
+    std::chrono::steady_clock::time_point epoch() const { return started; }
+
+    uint64_t reports_sent() const { return sent.load(std::memory_order_relaxed); }
+    uint64_t reports_dropped() const { return overflowed.load(std::memory_order_relaxed); }
+    uint64_t commands() const { return answered.load(std::memory_order_relaxed); }
+
+private:
+    class port : public transport
+    {
+    public:
+        port(sim_device* dev, int interface_num);
+
+        int write(const uint8_t* data, size_t length) override;
+        int read(uint8_t* data, size_t length, int timeout_ms) override;
+
+        // callers hold dev->lock
+        void queue(const uint8_t* frame, int len);
+        int take(uint8_t* data, size_t length);
+
+        std::condition_variable cv;
+
+    private:
+        sim_device* dev;
+        int interface_num;
+        uint8_t replies[REPLY_SLOTS][REPLY_SIZE];
+        int reply_len[REPLY_SLOTS];
+        int first;
+        int count;
+    };
+
+    void on_imu_command(const uint8_t* frame, int len);
+    void on_control_command(const uint8_t* frame, int len);
+    void reply_imu(uint8_t msgId, const uint8_t* p_buf, int p_size);
+    void reply_control(uint16_t msgId, const uint8_t* p_buf, int p_size);
+    // both with lock held, report_due() moves past reports lost to the backlog
+    uint64_t now_ns() const;
+    bool report_due(uint64_t now);
+    void build_report(uint64_t timestamp, uint8_t* out);
+
+    std::mutex lock;
+    port imu_port;
+    port control_port;
+    std::chrono::steady_clock::time_point started;
+
+    bool streaming;
+    uint64_t period_ns;          // 0 = paused
+    uint64_t next_report;        // device clock of the next report
+    uint64_t next_heartbeat;
+    uint32_t cal_offset;         // bytes of the calibration json already sent
+    uint8_t mode;
+
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> overflowed;
+    std::atomic<uint64_t> answered;
+};
@@ -0,0 +1,311 @@
+#include "soak.h"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+// "90", "90s", "30m", "8h"
+static bool
+parse_duration(const std::string& value, double* seconds)
+{
+    char* end = nullptr;
+    double v = strtod(value.c_str(), &end);
+    if (end == value.c_str() || v <= 0) return false;
+
+    std::string unit(end);
+    if (unit == "" || unit == "s") *seconds = v;
+    else if (unit == "m") *seconds = v * 60;
+    else if (unit == "h") *seconds = v * 3600;
+    else return false;
+    return true;
+}
+
+void
+soak::default_config(config* cfg)
+{
+    cfg->duration_s = 60;
+    cfg->imu_rates.assign(1, 1000.0f);
+    cfg->command_rate = 20;
+    cfg->interval_s = 10;
+    cfg->csv_path.clear();
+
+    // the simulator wakes on the OS timer, which on Windows can be 15 ms coarse
+    cfg->max_imu_p999_ms = 20;
+    cfg->max_command_p999_ms = 20;
+    cfg->min_delivered = 0.999;
+    cfg->max_dropped = 0;
+    cfg->max_lost_replies = 0;
+    cfg->max_rss_growth_mb = 16;
+    cfg->max_imu_allocs = 0;
+}
+
+bool
+soak::parse(const std::string& spec, config* cfg, std::string* error)
+{
+    std::istringstream in(spec);
+    std::string item;
+
+    while (std::getline(in, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            *error = "expected key=value, got '" + item + "'";
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        std::string value = item.substr(eq + 1);
+
+        if (key == "duration" || key == "interval") {
+            if (!parse_duration(value, key == "duration" ? &cfg->duration_s : &cfg->interval_s)) {
+                *error = "bad " + key + " '" + value + "', expected a number with s, m or h";
+                return false;
+            }
+        }
+        else if (key == "rates") {
+            std::istringstream rates(value);
+            std::string rate;
+            cfg->imu_rates.clear();
+            while (std::getline(rates, rate, ':')) {
+                float hz = (float)atof(rate.c_str());
+                if (hz <= 0) {
+                    *error = "bad rate '" + rate + "'";
+                    return false;
+                }
+                cfg->imu_rates.push_back(hz);
+            }
+        }
+        else if (key == "commands") {
+            char* end = nullptr;
+            cfg->command_rate = strtof(value.c_str(), &end);
+            if (end == value.c_str() || *end != '\0' || cfg->command_rate < 0) {
+                *error = "bad commands rate '" + value + "', expected 0 or more per second";
+                return false;
+            }
+        }
+        else if (key == "csv") cfg->csv_path = value;
+        else if (key == "imu_p999_ms") cfg->max_imu_p999_ms = atof(value.c_str());
+        else if (key == "command_p999_ms") cfg->max_command_p999_ms = atof(value.c_str());
+        else if (key == "delivered") cfg->min_delivered = atof(value.c_str());
+        else if (key == "dropped") cfg->max_dropped = strtoull(value.c_str(), nullptr, 10);
+        else if (key == "lost") cfg->max_lost_replies = strtoull(value.c_str(), nullptr, 10);
+        else if (key == "rss_mb") cfg->max_rss_growth_mb = atof(value.c_str());
+        else if (key == "imu_allocs") cfg->max_imu_allocs = strtoull(value.c_str(), nullptr, 10);
+        else {
+            *error = "unknown key '" + key + "'";
+            return false;
+        }
+    }
+
+    if (cfg->imu_rates.empty()) {
+        *error = "no IMU rates";
+        return false;
+    }
+    if (cfg->interval_s > cfg->duration_s) cfg->interval_s = cfg->duration_s;
+    return true;
+}
+
+std::string
+soak::describe(const config& cfg)
+{
+    std::ostringstream out;
+
+    out << cfg.duration_s << " s at";
+    for (size_t i = 0; i < cfg.imu_rates.size(); i++)
+        out << (i == 0 ? " " : "/") << cfg.imu_rates[i];
+    out << " Hz, " << cfg.command_rate << " commands/s, every " << cfg.interval_s << " s; limits imu p99.9 " << cfg.max_imu_p999_ms
+        << " ms, command p99.9 " << cfg.max_command_p999_ms << " ms, delivered " << cfg.min_delivered << ", dropped " << cfg.max_dropped
+        << ", lost " << cfg.max_lost_replies << ", rss +" << cfg.max_rss_growth_mb << " MB, imu allocations " << cfg.max_imu_allocs;
+    return out.str();
+}
+
+uint64_t
+soak::resident_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.WorkingSetSize;
+#else
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) return 0;
+
+    unsigned long long size = 0, resident = 0;
+    int fields = fscanf(statm, "%llu %llu", &size, &resident);
+    fclose(statm);
+    return fields == 2 ? resident * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+soak::soak(const config& cfg) :
+    cfg(cfg), csv(nullptr), intervals(0), failed(false), received(0), sent_commands(0), replies(0), lost(0), imu_allocs(0), command_allocs(0), epoch(0),
+    last_elapsed(0), last_received(0), last_reports(0), last_replies(0), last_dropped(0), last_lost(0), last_imu_allocs(0), last_command_allocs(0), rss_baseline(0), rss_peak(0)
+{
+}
+
+soak::interval_window::interval_window()
+{
+    tag[0].store(0, std::memory_order_relaxed);
+    tag[1].store(-1, std::memory_order_relaxed);
+}
+
+void
+soak::interval_window::record(uint64_t ns, int epoch)
+{
+    int i = epoch & 1;
+    // report() finished reading this half when it closed epoch - 2
+    if (tag[i].load(std::memory_order_relaxed) != epoch) {
+        half[i].reset();
+        tag[i].store(epoch, std::memory_order_release);
+    }
+    half[i].record(ns);
+}
+
+uint64_t
+soak::interval_window::percentile(int epoch, double p) const
+{
+    int i = epoch & 1;
+    return tag[i].load(std::memory_order_acquire) == epoch ? half[i].percentile(p) : 0;
+}
+
+soak::~soak()
+{
+    if (csv != nullptr) fclose(csv);
+}
+
+bool
+soak::open_csv()
+{
+    if (cfg.csv_path.empty()) return true;
+
+    csv = fopen(cfg.csv_path.c_str(), "w");
+    if (csv == nullptr) return false;
+    fprintf(csv, "elapsed_s,imu_rate_hz,imu_per_s,imu_p50_ms,imu_p99_ms,imu_p999_ms,commands_per_s,command_p50_ms,command_p99_ms,command_p999_ms,rss_mb,dropped,lost,imu_allocs,command_allocs,ok\n");
+    return true;
+}
+
+void
+soak::imu_received(uint64_t latency_ns)
+{
+    received.fetch_add(1, std::memory_order_relaxed);
+    imu_interval.record(latency_ns, epoch.load(std::memory_order_acquire));
+    imu_total.record(latency_ns);
+}
+
+void
+soak::command_sent()
+{
+    sent_commands.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+soak::command_replied(uint64_t rtt_ns)
+{
+    replies.fetch_add(1, std::memory_order_relaxed);
+    command_interval.record(rtt_ns, epoch.load(std::memory_order_acquire));
+    command_total.record(rtt_ns);
+}
+
+void
+soak::command_lost()
+{
+    lost.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+soak::imu_allocated(uint64_t n)
+{
+    imu_allocs.fetch_add(n, std::memory_order_relaxed);
+}
+
+void
+soak::command_allocated(uint64_t n)
+{
+    command_allocs.fetch_add(n, std::memory_order_relaxed);
+}
+
+bool
+soak::report(double elapsed_s, float imu_rate, uint64_t reports_sent, uint64_t dropped)
+{
+    double span = elapsed_s - last_elapsed;
+    if (span <= 0) span = 1;
+
+    uint64_t now_received = received.load(std::memory_order_relaxed);
+    uint64_t now_replies = replies.load(std::memory_order_relaxed);
+    uint64_t now_lost = lost.load(std::memory_order_relaxed);
+    // the device side counts since the start, the limits apply to this interval alone
+    uint64_t interval_dropped = dropped - last_dropped;
+    uint64_t interval_lost = now_lost - last_lost;
+    uint64_t interval_imu_allocs = imu_allocs.load(std::memory_order_relaxed) - last_imu_allocs;
+    uint64_t interval_command_allocs = command_allocs.load(std::memory_order_relaxed) - last_command_allocs;
+    uint64_t rss = resident_bytes();
+    if (rss > rss_peak) rss_peak = rss;
+
+    // later samples go to the next interval, a record() already under way may still land in this one
+    int closed = epoch.fetch_add(1, std::memory_order_acq_rel);
+    double imu_p50 = imu_interval.percentile(closed, 50) / 1e6, imu_p99 = imu_interval.percentile(closed, 99) / 1e6, imu_p999 = imu_interval.percentile(closed, 99.9) / 1e6;
+    double cmd_p50 = command_interval.percentile(closed, 50) / 1e6, cmd_p99 = command_interval.percentile(closed, 99) / 1e6, cmd_p999 = command_interval.percentile(closed, 99.9) / 1e6;
+    double delivered = reports_sent > last_reports ? (double)(now_received - last_received) / (reports_sent - last_reports) : 1.0;
+
+    std::ostringstream why;
+    why << std::fixed << std::setprecision(3);
+    if (intervals == 0) {
+        rss_baseline = rss;
+    }
+    else {
+        if (imu_p999 > cfg.max_imu_p999_ms) why << " imu p99.9 " << imu_p999 << " ms";
+        if (cmd_p999 > cfg.max_command_p999_ms) why << " command p99.9 " << cmd_p999 << " ms";
+        if (delivered < cfg.min_delivered) why << " delivered " << delivered;
+        if (interval_dropped > cfg.max_dropped) why << " dropped " << interval_dropped;
+        if (interval_lost > cfg.max_lost_replies) why << " lost " << interval_lost;
+        if (rss > rss_baseline && (rss - rss_baseline) / 1048576.0 > cfg.max_rss_growth_mb) why << " rss +" << (rss - rss_baseline) / 1048576.0 << " MB";
+        if (interval_imu_allocs > cfg.max_imu_allocs) why << " imu allocations " << interval_imu_allocs;
+    }
+    bool ok = why.str().empty();
+
+    std::cout << std::fixed << std::setprecision(1) << std::setw(8) << elapsed_s << " s  " << std::setw(6) << imu_rate << " Hz"
+        << "  imu " << std::setw(7) << (now_received - last_received) / span << "/s p50/p99/p99.9 " << std::setprecision(3) << imu_p50 << "/" << imu_p99 << "/" << imu_p999 << " ms"
+        << "  cmd " << std::setprecision(1) << (now_replies - last_replies) / span << "/s p50/p99/p99.9 " << std::setprecision(3) << cmd_p50 << "/" << cmd_p99 << "/" << cmd_p999 << " ms"
+        << "  rss " << std::setprecision(1) << rss / 1048576.0 << " MB  dropped " << interval_dropped << "  lost " << interval_lost << "  allocs " << interval_imu_allocs << "/" << interval_command_allocs
+        << (intervals == 0 ? "  warm up" : ok ? "" : "  FAIL:" + why.str()) << std::endl;
+
+    if (csv != nullptr) {
+        fprintf(csv, "%.1f,%.1f,%.1f,%.3f,%.3f,%.3f,%.1f,%.3f,%.3f,%.3f,%.1f,%llu,%llu,%llu,%llu,%d\n", elapsed_s, imu_rate, (now_received - last_received) / span,
+            imu_p50, imu_p99, imu_p999, (now_replies - last_replies) / span, cmd_p50, cmd_p99, cmd_p999, rss / 1048576.0,
+            (unsigned long long)interval_dropped, (unsigned long long)interval_lost, (unsigned long long)interval_imu_allocs, (unsigned long long)interval_command_allocs, ok ? 1 : 0);
+        fflush(csv);
+    }
+
+    last_elapsed = elapsed_s;
+    last_received = now_received;
+    last_reports = reports_sent;
+    last_replies = now_replies;
+    last_dropped = dropped;
+    last_lost = now_lost;
+    last_imu_allocs += interval_imu_allocs;
+    last_command_allocs += interval_command_allocs;
+    intervals++;
+
+    if (!ok) failed = true;
+    return ok;
+}
+
+bool
+soak::finish(double elapsed_s)
+{
+    std::cout << std::fixed << std::setprecision(3) << "soak " << (failed ? "FAILED" : "passed") << " after " << std::setprecision(1) << elapsed_s << " s: "
+        << received.load(std::memory_order_relaxed) << " samples, imu p50/p99/p99.9/max " << std::setprecision(3) << imu_total.percentile(50) / 1e6 << "/"
+        << imu_total.percentile(99) / 1e6 << "/" << imu_total.percentile(99.9) / 1e6 << "/" << imu_total.max() / 1e6 << " ms, "
+        << replies.load(std::memory_order_relaxed) << "/" << sent_commands.load(std::memory_order_relaxed) << " replies, rtt p50/p99/p99.9/max "
+        << command_total.percentile(50) / 1e6 << "/" << command_total.percentile(99) / 1e6 << "/" << command_total.percentile(99.9) / 1e6 << "/"
+        << command_total.max() / 1e6 << " ms, rss peak " << std::setprecision(1) << rss_peak / 1048576.0 << " MB (+"
+        << (rss_peak > rss_baseline ? rss_peak - rss_baseline : 0) / 1048576.0 << " after warm up), dropped " << last_dropped << ", lost " << lost.load(std::memory_order_relaxed) << ", allocations imu " << imu_allocs.load(std::memory_order_relaxed)
+        << " command " << command_allocs.load(std::memory_order_relaxed) << std::endl;
+    return !failed;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Bookkeeping for a long --soak run. The reader threads record into it as they go; every
+// interval the runner calls report(), which prints a line of throughput, latency
+// percentiles, resident memory and losses (and appends it to the csv), then checks that
+// interval against the limits. Checking per interval means a slow leak or creeping latency
+// fails the run when it crosses the line instead of being averaged away over hours.
+// Configured from "duration=8h,rates=500:1000:2000,commands=50,rss_mb=8".
+class soak
+{
+public:
+    typedef struct {
+        double duration_s;
+        std::vector<float> imu_rates;    // Hz, stepped through in equal slices of the duration
+        float command_rate;              // per second, 0 = IMU only
+        double interval_s;               // report and check period
+        std::string csv_path;            // empty = no csv
+
+        // limits, the first interval is warm up and only reported
+        double max_imu_p999_ms;          // report due on the device to sample in the decimator
+        double max_command_p999_ms;      // write to matching reply
+        double min_delivered;            // fraction of the reports the device sent
+        uint64_t max_dropped;            // reports lost to the backlog or a full ring, per interval
+        uint64_t max_lost_replies;       // per interval
+        double max_rss_growth_mb;        // over the resident size after warm up
+        uint64_t max_imu_allocs;         // heap allocations per interval on the IMU read path
+    } config;
+
+    static void default_config(config* cfg);
+    static bool parse(const std::string& spec, config* cfg, std::string* error);
+    static std::string describe(const config& cfg);
+    // resident set of this process in bytes, 0 if unknown
+    static uint64_t resident_bytes();
+
+    explicit soak(const config& cfg);
+    ~soak();
+
+    bool open_csv();
+
+    // reader threads
+    void imu_received(uint64_t latency_ns);
+    void command_sent();
+    void command_replied(uint64_t rtt_ns);
+    void command_lost();
+    // heap allocations one loop iteration made, as seen by alloc_tracker
+    void imu_allocated(uint64_t n);
+    void command_allocated(uint64_t n);
+
+    // runner, totals since the start; false once a limit is crossed
+    bool report(double elapsed_s, float imu_rate, uint64_t reports_sent, uint64_t dropped);
+    // whole run summary, returns the verdict
+    bool finish(double elapsed_s);
+
+private:
+    // Percentiles for one interval without clearing a histogram under its recording thread.
+    // report() closes an interval by bumping the epoch; the single thread recording into the
+    // window moves to the other half on its next record() and clears it there. A half is
+    // tagged with the epoch it holds, so one nobody recorded into reads as empty.
+    struct interval_window {
+        interval_window();
+        void record(uint64_t ns, int epoch);
+        // 0 if nothing was recorded during that epoch
+        uint64_t percentile(int epoch, double p) const;
+
+        latency_histogram half[2];
+        std::atomic<int> tag[2];
+    };
+
+    config cfg;
+    FILE* csv;
+    int intervals;
+    bool failed;
+
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> sent_commands;
+    std::atomic<uint64_t> replies;
+    std::atomic<uint64_t> lost;
+    std::atomic<uint64_t> imu_allocs;
+    std::atomic<uint64_t> command_allocs;
+    std::atomic<int> epoch;           // interval being recorded, bumped by report()
+    interval_window imu_interval;     // recorded by the IMU reader only
+    latency_histogram imu_total;
+    interval_window command_interval; // recorded by the command thread only
+    latency_histogram command_total;
+
+    // totals at the previous report
+    double last_elapsed;
+    uint64_t last_received;
+    uint64_t last_reports;
+    uint64_t last_replies;
+    uint64_t last_dropped;
+    uint64_t last_lost;
+    uint64_t last_imu_allocs;
+    uint64_t last_command_allocs;
+    uint64_t rss_baseline;
+    uint64_t rss_peak;
+};
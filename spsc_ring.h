@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+// Fixed capacity single producer / single consumer ring. push() and pop_batch()
+// are wait-free; a full ring rejects the new element so the producer never blocks.
+template <typename T>
+class spsc_ring
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit spsc_ring(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        items.reset(new T[size]);
+        mask = size - 1;
+    }
+
+    bool push(const T& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail_cache > mask) {
+            tail_cache = tail.load(std::memory_order_acquire);
+            if (h - tail_cache > mask) return false;
+        }
+        items[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // copies up to max items into out, returns how many
+    size_t pop_batch(T* out, size_t max)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t available = head.load(std::memory_order_acquire) - t;
+        size_t n = available < max ? available : max;
+
+        for (size_t i = 0; i < n; i++)
+            out[i] = items[(t + i) & mask];
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    bool pop(T* out) { return pop_batch(out, 1) == 1; }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::unique_ptr<T[]> items;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head{ 0 };
+    size_t tail_cache = 0;       // producer's last view of tail
+    alignas(64) std::atomic<size_t> tail{ 0 };
+};
@@ -0,0 +1,28 @@
+#include "../imu.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// libFuzzer target for imu::parse_sample and the calibration applied to what it returns.
+// A report is decoded exactly when is_sample accepts it, and nothing past REPORT_SIZE of
+// the input is read however long or short it is.
+//
+//   clang++ -std=c++20 -g -O1 -fsanitize=fuzzer,address,undefined tests/fuzz_imu_sample.cpp imu.cpp
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static imu::calibration cal;
+    static bool ready = (imu::default_calibration(&cal), true);
+    (void)ready;
+
+    if (size > 0xffff) return 0;
+
+    imu::sample s;
+    bool parsed = imu::parse_sample(data, (int)size, &s);
+    if (parsed != imu::is_sample(data, (int)size)) abort();
+
+    if (parsed) imu::apply_calibration(cal, &s);
+    return 0;
+}
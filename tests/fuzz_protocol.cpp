@@ -0,0 +1,31 @@
+#include "../protocol.h"
+
+#include <iostream>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// libFuzzer target for protocol::parse_rsp, the control interface (0xfd) frames.
+// Whatever the bytes, the parse must stay inside the input and the result, and a frame
+// may only validate when the payload it reports was actually received.
+//
+//   clang++ -std=c++20 -g -O1 -fsanitize=fuzzer,address,undefined tests/fuzz_protocol.cpp protocol.cpp -lz
+
+const int PAYLOAD_OFS = 22;
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    // parse_rsp prints every bad head, that would bury the fuzzer's own output
+    static bool quiet = (std::cout.setstate(std::ios::failbit), true);
+    (void)quiet;
+
+    if (size > 0xffff) return 0;
+
+    protocol::parsed_rsp rsp;
+    protocol::parse_rsp(data, (int)size, &rsp);
+
+    if (rsp.payload_size > sizeof(rsp.payload)) abort();
+    if (rsp.valid && (size_t)(PAYLOAD_OFS + rsp.payload_size) > size) abort();
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "../protocol3.h"
+
+#include <iostream>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// libFuzzer target for protocol3::parse_rsp, the IMU interface (0xaa) frames. Same
+// properties as fuzz_protocol.cpp: no read outside the input or the result, and a valid
+// frame's payload lies inside the received bytes.
+//
+//   clang++ -std=c++20 -g -O1 -fsanitize=fuzzer,address,undefined tests/fuzz_protocol3.cpp protocol3.cpp -lz
+
+const int PAYLOAD_OFS = 8;
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    // parse_rsp prints every bad head, that would bury the fuzzer's own output
+    static bool quiet = (std::cout.setstate(std::ios::failbit), true);
+    (void)quiet;
+
+    if (size > 0xffff) return 0;
+
+    protocol3::parsed_rsp rsp;
+    protocol3::parse_rsp(data, (int)size, &rsp);
+
+    if (rsp.payload_size > sizeof(rsp.payload)) abort();
+    if (rsp.valid && (size_t)(PAYLOAD_OFS + rsp.payload_size) > size) abort();
+    return 0;
+}
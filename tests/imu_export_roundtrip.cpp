@@ -0,0 +1,159 @@
+#include "../imu_export.h"
+
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Round trip for the columnar export: samples written through imu_export come back bit for
+// bit from read_timestamps and read_channel. Then the same file cut short at every layout
+// boundary (in the footer, the index, a block header and a block's data) still reads back,
+// minus the chunks that did not make it whole. Exits non-zero on the first failure:
+//
+//   g++ -std=c++20 -g -fsanitize=address,undefined tests/imu_export_roundtrip.cpp imu_export.cpp -lz -lpthread
+//
+// The seed is fixed so a failure reproduces; pass another one as the first argument.
+
+const uint32_t CHUNK = 256;
+const int ROWS = CHUNK * 5 + 77; // the last chunk is a partial one, written by close()
+const char* PATH = "imu_export_roundtrip.tmp";
+const char* CUT_PATH = "imu_export_roundtrip_cut.tmp";
+
+static int failures = 0;
+
+static void
+fail(const char* what, long long detail)
+{
+    printf("%s (%lld)\n", what, detail);
+    failures++;
+}
+
+static float
+channel_value(const imu::sample& s, int channel)
+{
+    if (channel >= imu_export::CH_GYRO_X && channel <= imu_export::CH_GYRO_Z) return s.gyro[channel - imu_export::CH_GYRO_X];
+    if (channel >= imu_export::CH_ACCEL_X && channel <= imu_export::CH_ACCEL_Z) return s.accel[channel - imu_export::CH_ACCEL_X];
+    if (channel >= imu_export::CH_MAG_X && channel <= imu_export::CH_MAG_Z) return s.mag[channel - imu_export::CH_MAG_X];
+    return s.temperature;
+}
+
+// the first rows samples of every channel must read back exactly
+static void
+check(const char* path, const std::vector<imu::sample>& samples, size_t rows, const char* what)
+{
+    std::vector<uint64_t> ts;
+    if (!imu_export::read_timestamps(path, &ts)) {
+        fail(what, -1);
+        return;
+    }
+    if (ts.size() != rows) {
+        fail(what, (long long)ts.size());
+        return;
+    }
+    for (size_t i = 0; i < rows; i++) {
+        if (ts[i] != samples[i].timestamp) {
+            fail(what, (long long)i);
+            return;
+        }
+    }
+
+    std::vector<float> values;
+    for (int ch = imu_export::CH_GYRO_X; ch < imu_export::CHANNEL_COUNT; ch++) {
+        if (!imu_export::read_channel(path, ch, &values) || values.size() != rows) {
+            fail(imu_export::channel_name(ch), (long long)values.size());
+            return;
+        }
+        for (size_t i = 0; i < rows; i++) {
+            float expected = channel_value(samples[i], ch);
+            if (memcmp(&values[i], &expected, sizeof(float)) != 0) {
+                fail(imu_export::channel_name(ch), (long long)i);
+                return;
+            }
+        }
+    }
+}
+
+static bool
+copy_prefix(const std::vector<uint8_t>& file, size_t size)
+{
+    FILE* f = fopen(CUT_PATH, "wb");
+    if (f == nullptr) return false;
+    bool ok = fwrite(file.data(), 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+int
+main(int argc, char** argv)
+{
+    unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 1;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> value(-2000.0f, 2000.0f);
+
+    std::vector<imu::sample> samples(ROWS);
+    uint64_t t = 1000000000ull;
+    for (imu::sample& s : samples) {
+        t += 1000000 + rng() % 5000; // 1 kHz with jitter
+        s.timestamp = t;
+        for (int i = 0; i < 3; i++) {
+            s.gyro[i] = value(rng);
+            s.accel[i] = value(rng) / 1000;
+            s.mag[i] = value(rng) / 4000;
+        }
+        s.temperature = 30 + value(rng) / 1000;
+    }
+
+    imu_export exporter;
+    if (!exporter.open(PATH, CHUNK)) {
+        printf("FAILED, unable to create %s\n", PATH);
+        return 1;
+    }
+    for (const imu::sample& s : samples) exporter.add(s);
+    if (!exporter.close()) fail("close", 0);
+    check(PATH, samples, ROWS, "closed file");
+
+    // cut points: inside the tail, inside the index, inside the last block, in a block header
+    std::vector<imu_export::chunk_info> index;
+    if (!imu_export::read_index(PATH, &index) || index.size() != 6 * imu_export::CHANNEL_COUNT) fail("index", (long long)index.size());
+
+    std::vector<uint8_t> file;
+    FILE* f = fopen(PATH, "rb");
+    if (f != nullptr) {
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) file.insert(file.end(), buf, buf + n);
+        fclose(f);
+    }
+
+    if (failures == 0) {
+        const imu_export::chunk_info& last = index.back();
+        const imu_export::chunk_info& third_chunk = index[2 * imu_export::CHANNEL_COUNT];
+        struct {
+            size_t size;
+            size_t rows;
+            const char* what;
+        } cuts[] = {
+            { file.size() - 1, ROWS, "cut in the tail" },
+            { (size_t)(last.offset + last.stored_size) + 7, ROWS, "cut in the index" },
+            { (size_t)(last.offset + last.stored_size), ROWS, "cut before the index" },
+            { (size_t)(last.offset + last.stored_size) - 1, CHUNK * 5, "cut in the last block" },
+            { (size_t)third_chunk.offset - 3, CHUNK * 2, "cut in a block header" },
+            { (size_t)third_chunk.offset + 1, CHUNK * 2, "cut in the first block of a chunk" },
+            { 16, 0, "header only" },
+        };
+        for (const auto& cut : cuts) {
+            if (!copy_prefix(file, cut.size)) {
+                fail("unable to write the cut copy", (long long)cut.size);
+                break;
+            }
+            check(CUT_PATH, samples, cut.rows, cut.what);
+        }
+    }
+
+    remove(PATH);
+    remove(CUT_PATH);
+
+    printf("%s, seed %u, %d samples in chunks of %u\n", failures == 0 ? "passed" : "FAILED", seed, ROWS, CHUNK);
+    return failures == 0 ? 0 : 1;
+}
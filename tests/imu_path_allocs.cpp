@@ -0,0 +1,106 @@
+#include "../alloc_tracker.h"
+#include "../imu.h"
+#include "../imu_decimator.h"
+#include "../protocol3.h"
+#include "../protocol_codec.h"
+#include "../sim_device.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The IMU hot path must not touch the heap once running: reads from the simulated device,
+// imu::parse_sample, imu::apply_calibration and imu_decimator::push, with the outputs
+// drained on the same thread, run SAMPLES times after a warm-up and alloc_tracker::count()
+// has to come out unchanged. Exits non-zero otherwise. Links the operator new replacement:
+//
+//   g++ -std=c++20 -g -O1 tests/imu_path_allocs.cpp alloc_tracker.cpp sim_device.cpp imu.cpp imu_decimator.cpp protocol.cpp protocol3.cpp -lz -lpthread
+
+const int WARM_UP = 200;
+const int SAMPLES = 5000;
+const float RATE_HZ = 20000.0f; // faster than the glasses so the run takes a fraction of a second
+
+static bool
+start_stream(transport* device_imu)
+{
+    protocol_codec::imu_stream_request request;
+    request.enable = 1;
+
+    uint8_t p_buf[protocol_codec::imu_stream_request::SIZE];
+    int p_size = protocol_codec::encode(request, p_buf, sizeof(p_buf));
+
+    uint8_t cmd_buf[1024];
+    memset(cmd_buf, 0, sizeof(cmd_buf));
+    int cmd_len = protocol3::cmd_build(protocol3::START_IMU_DATA, p_buf, p_size, &cmd_buf[1], sizeof(cmd_buf) - 1);
+    return cmd_len > 0 && device_imu->write(cmd_buf, cmd_len + 1) >= 0;
+}
+
+// one report through the whole path, false on a read error or timeout
+static bool
+step(transport* device_imu, const imu::calibration& cal, imu_decimator* decimator)
+{
+    uint8_t read_buf[1024];
+    imu::sample sample;
+    imu::sample batch[64];
+
+    int res = device_imu->read(read_buf, sizeof(read_buf), 100);
+    if (res <= 0) return false;
+    if (imu::parse_sample(read_buf, res, &sample)) {
+        imu::apply_calibration(cal, &sample);
+        decimator->push(sample);
+    }
+    for (int i = 0; i < decimator->streams(); i++) {
+        while (decimator->ring(i).pop_batch(batch, 64) == 64) {}
+    }
+    return true;
+}
+
+int
+main()
+{
+    // the replacement must be linked in, or an unchanged count proves nothing
+    uint64_t before = alloc_tracker::count();
+    int* volatile probe = new int(0); // volatile so the pair is not optimized away
+    delete probe;
+    if (alloc_tracker::count() == before) {
+        printf("FAILED, alloc_tracker.cpp is not replacing operator new\n");
+        return 1;
+    }
+
+    sim_device sim;
+    imu::calibration cal;
+    imu::default_calibration(&cal);
+
+    imu_decimator decimator(RATE_HZ);
+    decimator.add_stream(RATE_HZ, 1024);
+    decimator.add_stream(RATE_HZ / 10, 64);
+    decimator.add_stream(RATE_HZ / 200, 16);
+
+    sim.set_imu_rate(RATE_HZ);
+    if (!start_stream(sim.imu())) {
+        printf("FAILED, unable to start the IMU stream\n");
+        return 1;
+    }
+
+    for (int i = 0; i < WARM_UP; i++) {
+        if (!step(sim.imu(), cal, &decimator)) {
+            printf("FAILED, no IMU report during warm-up\n");
+            return 1;
+        }
+    }
+
+    uint64_t allocs = alloc_tracker::count();
+    uint64_t bytes = alloc_tracker::bytes();
+    for (int i = 0; i < SAMPLES; i++) {
+        if (!step(sim.imu(), cal, &decimator)) {
+            printf("FAILED, no IMU report after %d samples\n", i);
+            return 1;
+        }
+    }
+    allocs = alloc_tracker::count() - allocs;
+    bytes = alloc_tracker::bytes() - bytes;
+
+    printf("%s, %d samples, %llu allocations (%llu bytes)\n", allocs == 0 ? "passed" : "FAILED", SAMPLES,
+        (unsigned long long)allocs, (unsigned long long)bytes);
+    return allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#include "../protocol.h"
+#include "../protocol3.h"
+
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// Round trip property for both framings: for every message in protocol_schema.inc and
+// random payloads up to what parsed_rsp holds, parse_rsp(cmd_build(...)) gives back the
+// msgId and payload bytes and validates; the same frame with a CRC byte flipped, or cut
+// one byte short, does not. Exits non-zero on the first failure. Run it under ASan/UBSan:
+//
+//   g++ -std=c++20 -g -fsanitize=address,undefined tests/protocol_roundtrip.cpp protocol.cpp protocol3.cpp -lz
+//
+// The seed is fixed so a failure reproduces; pass another one as the first argument.
+
+const int ROUNDS = 256;
+const int CRC_OFS = 1;
+
+typedef struct {
+    const char* name;
+    unsigned id;
+} message;
+
+static const message CONTROL_MESSAGES[] = {
+#define CONTROL_MSG(name, id, print) { #name, id },
+#include "../protocol_schema.inc"
+};
+
+static const message IMU_MESSAGES[] = {
+#define IMU_MSG(name, id, print) { #name, id },
+#include "../protocol_schema.inc"
+};
+
+static int failures = 0;
+
+static void
+fail(const char* interface_name, const message& m, int payload_size, const char* what)
+{
+    printf("%s %s (0x%x), %d byte payload: %s\n", interface_name, m.name, m.id, payload_size, what);
+    failures++;
+}
+
+// one build -> parse -> corrupt cycle, Rsp and Build/Parse are the protocol or protocol3 pieces
+template <typename Rsp, typename Build, typename Parse>
+static void
+check(const char* interface_name, const message& m, const std::vector<uint8_t>& payload, Build build, Parse parse)
+{
+    uint8_t frame[1024];
+    memset(frame, 0x5a, sizeof(frame)); // cmd_build must not rely on the caller zeroing the buffer
+
+    int p_size = (int)payload.size();
+    int len = build(m.id, payload.data(), p_size, frame, (int)sizeof(frame));
+    if (len <= 0) {
+        fail(interface_name, m, p_size, "cmd_build refused the frame");
+        return;
+    }
+
+    Rsp rsp;
+    parse(frame, len, &rsp);
+    if (!rsp.valid) fail(interface_name, m, p_size, "valid frame rejected");
+    if (rsp.msgId != m.id) fail(interface_name, m, p_size, "msgId changed");
+    if (rsp.payload_size != p_size || (p_size > 0 && memcmp(rsp.payload, payload.data(), p_size) != 0)) fail(interface_name, m, p_size, "payload changed");
+
+    for (int i = 0; i < 4; i++) {
+        frame[CRC_OFS + i] ^= 0x01;
+        parse(frame, len, &rsp);
+        if (rsp.valid) fail(interface_name, m, p_size, "flipped CRC byte accepted");
+        frame[CRC_OFS + i] ^= 0x01;
+    }
+
+    parse(frame, len - 1, &rsp);
+    if (rsp.valid) fail(interface_name, m, p_size, "truncated frame accepted");
+}
+
+int
+main(int argc, char** argv)
+{
+    unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], nullptr, 10) : 20221015u;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    const int control_max = (int)sizeof(protocol::parsed_rsp::payload);
+    const int imu_max = (int)sizeof(protocol3::parsed_rsp::payload);
+    std::vector<uint8_t> payload;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (const message& m : CONTROL_MESSAGES) {
+            // the empty and the largest payload every time, random sizes in between
+            int size = round == 0 ? 0 : round == 1 ? control_max : std::uniform_int_distribution<int>(0, control_max)(rng);
+            payload.resize(size);
+            for (uint8_t& b : payload) b = (uint8_t)byte(rng);
+            check<protocol::parsed_rsp>("control", m, payload,
+                [](unsigned id, const uint8_t* p, int n, uint8_t* buf, int cap) { return protocol::cmd_build((uint16_t)id, p, n, buf, cap); },
+                [](const uint8_t* buf, int n, protocol::parsed_rsp* out) { protocol::parse_rsp(buf, n, out); });
+        }
+        for (const message& m : IMU_MESSAGES) {
+            int size = round == 0 ? 0 : round == 1 ? imu_max : std::uniform_int_distribution<int>(0, imu_max)(rng);
+            payload.resize(size);
+            for (uint8_t& b : payload) b = (uint8_t)byte(rng);
+            check<protocol3::parsed_rsp>("imu", m, payload,
+                [](unsigned id, const uint8_t* p, int n, uint8_t* buf, int cap) { return protocol3::cmd_build((uint8_t)id, p, n, buf, cap); },
+                [](const uint8_t* buf, int n, protocol3::parsed_rsp* out) { protocol3::parse_rsp(buf, n, out); });
+        }
+        if (failures > 0) break;
+    }
+
+    printf("%s, seed %u, %d control and %d imu messages, %d rounds\n", failures == 0 ? "passed" : "FAILED", seed,
+        (int)(sizeof(CONTROL_MESSAGES) / sizeof(CONTROL_MESSAGES[0])), (int)(sizeof(IMU_MESSAGES) / sizeof(IMU_MESSAGES[0])), ROUNDS);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// What the protocol code needs from a device interface. Semantics follow hidapi:
+// write() takes the report id in data[0], read() returns the number of bytes read,
+// 0 on timeout and -1 on error. timeout_ms < 0 blocks.
+class transport
+{
+public:
+    virtual ~transport() {}
+
+    virtual int write(const uint8_t* data, size_t length) = 0;
+    virtual int read(uint8_t* data, size_t length, int timeout_ms) = 0;
+};